@@ -0,0 +1,387 @@
+#ifndef __STM32F103C8_ATOMIC_H__
+#define __STM32F103C8_ATOMIC_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/*
+ * Lock-free primitives for sharing data between ISRs and thread code.
+ *
+ * On the Cortex-M3, atomic read-modify-write operations are built on the
+ * exclusive load/store instructions LDREX and STREX (see section 3.4.8 in
+ * the STM32F10xxx Cortex-M3 programming manual). The local exclusive
+ * monitor is cleared on exception entry and return, so an operation that
+ * is preempted between LDREX and STREX fails its STREX and retries.
+ *
+ * When built for something other than ARMv7-M (e.g., a host test program
+ * where threads stand in for ISRs, see tools/atomictest.c), LDREX and
+ * STREX are emulated with the GCC __atomic builtins: STREX fails if the
+ * value has changed since LDREX. A test may define ATOMIC_PREEMPT() to
+ * yield between the two, as an interrupt would. The critical section
+ * functions do nothing.
+ */
+#if defined(__ARM_ARCH_7M__)
+
+static inline uint32_t atomic_ldrex(volatile uint32_t* addr)
+{
+    uint32_t value;
+    __asm__ volatile ("ldrex %0, [%1]" : "=r" (value) : "r" (addr) : "memory");
+    return value;
+}
+
+
+static inline uint32_t atomic_strex(volatile uint32_t* addr, uint32_t value)
+{
+    uint32_t failed;
+    __asm__ volatile ("strex %0, %2, [%1]" : "=&r" (failed) : "r" (addr), "r" (value) : "memory");
+    return failed;
+}
+
+
+static inline void atomic_clrex(void)
+{
+    __asm__ volatile ("clrex" ::: "memory");
+}
+
+
+/*
+ * Data memory barrier.
+ * Also acts as a compiler barrier.
+ */
+static inline void atomic_barrier(void)
+{
+    __asm__ volatile ("dmb" ::: "memory");
+}
+
+
+/*
+ * Critical section that masks only interrupts with priority value
+ * greater than or equal to priority (1-15), i.e., interrupts of the same
+ * or lower urgency. More urgent interrupts are never blocked. With the
+ * default grouping (four preemption bits), this is the same value as
+ * the preemption priority given to irq_set_priority().
+ *
+ * BASEPRI_MAX only ever raises the masking level, so critical sections
+ * nest correctly. Returns the previous BASEPRI, to be passed to
+ * critical_exit().
+ *
+ * Priority 0 can not be used, as BASEPRI = 0 disables masking.
+ * See section 2.1.3 in STM32F10xxx Cortex-M3 programming manual.
+ */
+static inline uint32_t critical_enter(uint32_t priority)
+{
+    uint32_t basepri;
+    __asm__ volatile ("mrs %0, basepri\n\tmsr basepri_max, %1"
+            : "=&r" (basepri) : "r" ((priority & 0x0f) << 4) : "memory");
+    return basepri;
+}
+
+
+static inline void critical_exit(uint32_t basepri)
+{
+    __asm__ volatile ("msr basepri, %0" :: "r" (basepri) : "memory");
+}
+
+#else
+
+#ifndef ATOMIC_PREEMPT
+#define ATOMIC_PREEMPT()
+#endif
+
+
+/*
+ * Value seen by the last atomic_ldrex() of this thread
+ */
+static _Thread_local uint32_t atomic_reserved;
+
+
+static inline uint32_t atomic_ldrex(volatile uint32_t* addr)
+{
+    atomic_reserved = __atomic_load_n(addr, __ATOMIC_SEQ_CST);
+    ATOMIC_PREEMPT();
+    return atomic_reserved;
+}
+
+
+static inline uint32_t atomic_strex(volatile uint32_t* addr, uint32_t value)
+{
+    return !__atomic_compare_exchange_n(addr, &atomic_reserved, value, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+
+static inline void atomic_clrex(void)
+{
+}
+
+
+static inline void atomic_barrier(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+
+static inline uint32_t critical_enter(uint32_t priority)
+{
+    (void) priority;
+    atomic_barrier();
+    return 0;
+}
+
+
+static inline void critical_exit(uint32_t basepri)
+{
+    (void) basepri;
+    atomic_barrier();
+}
+
+#endif
+
+
+/*
+ * Atomically add value to *addr and return the previous value.
+ */
+static inline uint32_t atomic_add(volatile uint32_t* addr, uint32_t value)
+{
+    uint32_t old;
+    do {
+        old = atomic_ldrex(addr);
+    } while (atomic_strex(addr, old + value));
+    return old;
+}
+
+
+/*
+ * Atomically replace *addr with value and return the previous value.
+ */
+static inline uint32_t atomic_xchg(volatile uint32_t* addr, uint32_t value)
+{
+    uint32_t old;
+    do {
+        old = atomic_ldrex(addr);
+    } while (atomic_strex(addr, value));
+    return old;
+}
+
+
+/*
+ * Compare-and-swap: if *addr equals expected, replace it with desired.
+ * Returns non-zero on success.
+ */
+static inline int atomic_cas(volatile uint32_t* addr, uint32_t expected, uint32_t desired)
+{
+    do {
+        if (atomic_ldrex(addr) != expected) {
+            atomic_clrex();
+            return 0;
+        }
+    } while (atomic_strex(addr, desired));
+    return 1;
+}
+
+
+
+/*
+ * Sequence lock for multi-word snapshots.
+ *
+ * The writer makes the sequence odd while updating, readers retry if the
+ * sequence was odd or changed while they were reading. Readers never
+ * block the writer, but a reader must not preempt the writer (it would
+ * spin forever), so readers must run at lower priority than the writer.
+ * Multiple writers must be serialized, e.g., with critical_enter().
+ *
+ *   do {
+ *       seq = seqlock_read_begin(&lock);
+ *       ...copy data...
+ *   } while (seqlock_read_retry(&lock, seq));
+ */
+struct seqlock
+{
+    volatile uint32_t seq;
+};
+
+
+static inline void seqlock_write_begin(struct seqlock* lock)
+{
+    lock->seq = lock->seq + 1;
+    atomic_barrier();
+}
+
+
+static inline void seqlock_write_end(struct seqlock* lock)
+{
+    atomic_barrier();
+    lock->seq = lock->seq + 1;
+}
+
+
+static inline uint32_t seqlock_read_begin(const struct seqlock* lock)
+{
+    uint32_t seq;
+    while ((seq = lock->seq) & 1);
+    atomic_barrier();
+    return seq;
+}
+
+
+static inline int seqlock_read_retry(const struct seqlock* lock, uint32_t seq)
+{
+    atomic_barrier();
+    return lock->seq != seq;
+}
+
+
+
+/*
+ * Single-producer single-consumer ring of 32-bit values.
+ *
+ * Producer and consumer each own one index, so no read-modify-write is
+ * needed. The capacity must be a power of two, buf must hold that many
+ * values.
+ */
+struct spsc
+{
+    volatile uint32_t head;     // Written by producer
+    volatile uint32_t tail;     // Written by consumer
+    uint32_t mask;
+    uint32_t* buf;
+};
+
+
+static inline void spsc_init(struct spsc* q, uint32_t* buf, uint32_t capacity)
+{
+    q->head = 0;
+    q->tail = 0;
+    q->mask = capacity - 1;
+    q->buf = buf;
+}
+
+
+/*
+ * Returns 0 on success and -1 if the queue is full.
+ */
+static inline int spsc_push(struct spsc* q, uint32_t value)
+{
+    uint32_t head = q->head;
+
+    if (head - q->tail > q->mask) {
+        return -1;
+    }
+
+    q->buf[head & q->mask] = value;
+    atomic_barrier();
+    q->head = head + 1;
+    return 0;
+}
+
+
+/*
+ * Returns 0 on success and -1 if the queue is empty.
+ */
+static inline int spsc_pop(struct spsc* q, uint32_t* value)
+{
+    uint32_t tail = q->tail;
+
+    if (tail == q->head) {
+        return -1;
+    }
+
+    atomic_barrier();
+    *value = q->buf[tail & q->mask];
+    atomic_barrier();
+    q->tail = tail + 1;
+    return 0;
+}
+
+
+
+/*
+ * Multi-producer single-consumer ring of 32-bit values.
+ *
+ * Bounded queue where each slot carries a sequence number telling whether
+ * it is free for the producer claiming that position or holds a value for
+ * the consumer. Producers claim positions with compare-and-swap on head,
+ * so any number of ISRs may push concurrently. A producer that is preempted
+ * after claiming a slot delays the consumer (not other producers) until it
+ * has published its value.
+ */
+struct mpsc_slot
+{
+    volatile uint32_t seq;
+    uint32_t value;
+};
+
+
+struct mpsc
+{
+    volatile uint32_t head;     // Next position to claim
+    uint32_t tail;              // Next position to consume
+    uint32_t mask;
+    struct mpsc_slot* slots;
+};
+
+
+static inline void mpsc_init(struct mpsc* q, struct mpsc_slot* slots, uint32_t capacity)
+{
+    q->head = 0;
+    q->tail = 0;
+    q->mask = capacity - 1;
+    q->slots = slots;
+
+    for (uint32_t i = 0; i < capacity; ++i) {
+        slots[i].seq = i;
+    }
+}
+
+
+/*
+ * Returns 0 on success and -1 if the queue is full.
+ */
+static inline int mpsc_push(struct mpsc* q, uint32_t value)
+{
+    uint32_t pos = q->head;
+    struct mpsc_slot* slot;
+
+    while (1) {
+        slot = &q->slots[pos & q->mask];
+        int32_t diff = (int32_t) (slot->seq - pos);
+
+        if (diff == 0) {
+            if (atomic_cas(&q->head, pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        }
+
+        pos = q->head;
+    }
+
+    slot->value = value;
+    atomic_barrier();
+    slot->seq = pos + 1;
+    return 0;
+}
+
+
+/*
+ * Returns 0 on success and -1 if the queue is empty.
+ */
+static inline int mpsc_pop(struct mpsc* q, uint32_t* value)
+{
+    struct mpsc_slot* slot = &q->slots[q->tail & q->mask];
+
+    if (slot->seq != q->tail + 1) {
+        return -1;
+    }
+
+    atomic_barrier();
+    *value = slot->value;
+    atomic_barrier();
+    slot->seq = q->tail + q->mask + 1;
+    ++q->tail;
+    return 0;
+}
+
+#endif
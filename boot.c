@@ -0,0 +1,406 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include "boot.h"
+#include "flash.h"
+#include "crc.h"
+
+#define FRAME_MAX   (BOOT_DATA_MAX + 8)
+
+
+/*
+ * Frame being received (COBS encoded) and decoded frame
+ */
+static uint8_t raw[FRAME_MAX + FRAME_MAX / 254 + 2];
+static uint16_t raw_len;
+static int raw_overflow;
+static uint8_t frame[FRAME_MAX];
+
+static uint16_t tx_seq;
+
+
+/*
+ * Decoder states
+ */
+enum
+{
+    LZ_TOKEN,
+    LZ_LITLEN,
+    LZ_LITERAL,
+    LZ_OFFSET_LO,
+    LZ_OFFSET_HI,
+    LZ_MATCHLEN,
+    LZ_DONE
+};
+
+
+/*
+ * Image being programmed
+ */
+static struct
+{
+    int active;
+    int encoding;
+    uint32_t length;        // Image length
+    uint32_t crc;           // Expected CRC-32
+    uint16_t expect;        // Expected sequence number of next BOOT_DATA
+    uint32_t out;           // Bytes decoded
+    uint8_t pending;        // Decoded byte waiting for its half-word
+    uint8_t state;          // Decoder state
+    uint8_t match_ext;      // Match length continues after offset
+    uint16_t offset;        // Match offset
+    uint32_t lit;           // Literal bytes left
+    uint32_t match;         // Match length
+} img;
+
+
+/*
+ * CRC-16/CCITT-FALSE, as used by the telemetry framing
+ */
+static uint16_t crc16(uint16_t crc, const uint8_t* data, size_t len)
+{
+    while (len-- > 0) {
+        crc ^= *data++ << 8;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+
+/*
+ * Send a reply frame. Replies are short, so this is done by polling.
+ */
+static void reply(uint8_t type, int status, uint16_t seq, uint32_t value)
+{
+    uint8_t buf[13] = {
+        tx_seq & 0xff, tx_seq >> 8, BOOT_REPLY,
+        type, (uint8_t) status, seq & 0xff, seq >> 8,
+        value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff, value >> 24
+    };
+
+    uint16_t crc = crc16(0xffff, buf, 11);
+    buf[11] = crc & 0xff;
+    buf[12] = crc >> 8;
+    ++tx_seq;
+
+    // COBS encode (the frame is shorter than 254 bytes)
+    size_t start = 0;
+    for (size_t i = 0; i <= sizeof(buf); ++i) {
+        if (i == sizeof(buf) || buf[i] == 0) {
+            boot_putc(i - start + 1);
+            while (start < i) {
+                boot_putc(buf[start++]);
+            }
+            ++start;
+        }
+    }
+    boot_putc(0);
+}
+
+
+/*
+ * Byte at position pos of the decoded image.
+ */
+static uint8_t history(uint32_t pos)
+{
+    if ((img.out & 1) && pos == img.out - 1) {
+        return img.pending;
+    }
+    return *(const volatile uint8_t*) (BOOT_APP_BASE + pos);
+}
+
+
+/*
+ * Add a decoded byte, programming flash a half-word at a time.
+ */
+static int output(uint8_t byte)
+{
+    if (img.out >= img.length) {
+        return -EBADMSG;
+    }
+
+    if (img.out++ & 1) {
+        return flash_write(BOOT_APP_BASE + img.out - 2, img.pending | (byte << 8));
+    }
+
+    img.pending = byte;
+    return 0;
+}
+
+
+static int copy_match(void)
+{
+    if (img.offset == 0 || img.offset > img.out || img.match > img.length - img.out) {
+        return -EBADMSG;
+    }
+
+    while (img.match-- > 0) {
+        int status = output(history(img.out - img.offset));
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    img.state = img.out == img.length ? LZ_DONE : LZ_TOKEN;
+    return 0;
+}
+
+
+/*
+ * Feed one byte of the LZ (LZ4 block) stream to the decoder.
+ */
+static int decode(uint8_t byte)
+{
+    switch (img.state) {
+        case LZ_TOKEN:
+            img.lit = byte >> 4;
+            img.match = (byte & 0xf) + 4;
+            img.match_ext = (byte & 0xf) == 0xf;
+            img.state = img.lit == 0xf ? LZ_LITLEN : img.lit > 0 ? LZ_LITERAL : LZ_OFFSET_LO;
+            return 0;
+
+        case LZ_LITLEN:
+            img.lit += byte;
+            if (byte != 0xff) {
+                img.state = LZ_LITERAL;
+            }
+            return 0;
+
+        case LZ_LITERAL:
+            if (--img.lit == 0) {
+                img.state = img.out + 1 == img.length ? LZ_DONE : LZ_OFFSET_LO;
+            }
+            return output(byte);
+
+        case LZ_OFFSET_LO:
+            img.offset = byte;
+            img.state = LZ_OFFSET_HI;
+            return 0;
+
+        case LZ_OFFSET_HI:
+            img.offset |= byte << 8;
+            if (img.match_ext) {
+                img.state = LZ_MATCHLEN;
+                return 0;
+            }
+            return copy_match();
+
+        case LZ_MATCHLEN:
+            img.match += byte;
+            if (byte != 0xff) {
+                return copy_match();
+            }
+            return 0;
+
+        default:
+            return -EBADMSG;
+    }
+}
+
+
+static int begin(const uint8_t* data, size_t len)
+{
+    if (len != 9) {
+        return -EINVAL;
+    }
+
+    uint32_t length = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+    uint32_t crc = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t) data[7] << 24);
+
+    if (length == 0 || length > BOOT_APP_SIZE || data[8] > BOOT_LZ) {
+        return -EINVAL;
+    }
+
+    img.active = 0;
+
+    // Invalidate the current image first, then mark the update as started
+    if (flash_erase(BOOT_INFO_BASE) != 0
+            || flash_write(BOOT_INFO_BASE, BOOT_INFO_MAGIC & 0xffff) != 0
+            || flash_write(BOOT_INFO_BASE + 2, BOOT_INFO_MAGIC >> 16) != 0) {
+        return -EIO;
+    }
+
+    for (uint32_t addr = 0; addr < length; addr += FLASH_PAGE_SIZE) {
+        if (flash_erase(BOOT_APP_BASE + addr) != 0) {
+            return -EIO;
+        }
+    }
+
+    img.active = 1;
+    img.encoding = data[8];
+    img.length = length;
+    img.crc = crc;
+    img.out = 0;
+    img.state = LZ_TOKEN;
+    return 0;
+}
+
+
+static int program(const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        int status = img.encoding == BOOT_LZ ? decode(data[i]) : output(data[i]);
+        if (status != 0) {
+            img.active = 0;
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+
+static int end(void)
+{
+    const volatile struct boot_info* info = (const volatile struct boot_info*) BOOT_INFO_BASE;
+
+    img.active = 0;
+
+    if (img.out != img.length || (img.encoding == BOOT_LZ && img.state != LZ_DONE)) {
+        return -EBADMSG;
+    }
+
+    if ((img.length & 1) && flash_write(BOOT_APP_BASE + img.length - 1, img.pending | 0xff00) != 0) {
+        return -EIO;
+    }
+
+    if (crc32((const void*) BOOT_APP_BASE, img.length) != img.crc) {
+        return -EBADMSG;
+    }
+
+    if (flash_write((uint32_t) &info->length, img.length & 0xffff) != 0
+            || flash_write((uint32_t) &info->length + 2, img.length >> 16) != 0
+            || flash_write((uint32_t) &info->crc, img.crc & 0xffff) != 0
+            || flash_write((uint32_t) &info->crc + 2, img.crc >> 16) != 0
+            || flash_write((uint32_t) &info->valid, 0) != 0
+            || flash_write((uint32_t) &info->valid + 2, 0) != 0) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+
+static void handle(uint16_t seq, uint8_t type, const uint8_t* payload, size_t len)
+{
+    int status = 0;
+    uint32_t value = 0;
+
+    switch (type) {
+        case BOOT_HELLO:
+            value = BOOT_APP_SIZE;
+            break;
+
+        case BOOT_BEGIN:
+            status = begin(payload, len);
+            img.expect = seq + 1;
+            break;
+
+        case BOOT_DATA:
+            if (!img.active) {
+                status = -EINVAL;
+            } else if (seq != img.expect) {
+                status = -EAGAIN;
+                value = img.expect;
+            } else {
+                status = program(payload, len);
+                value = img.out;
+                ++img.expect;
+            }
+            break;
+
+        case BOOT_END:
+            status = img.active ? end() : -EINVAL;
+            break;
+
+        case BOOT_RUN:
+            reply(type, 0, seq, 0);
+            boot_reset();
+            break;
+
+        default:
+            status = -EINVAL;
+            break;
+    }
+
+    reply(type, status, seq, value);
+}
+
+
+/*
+ * Decode and check a received frame (see telemetry.h).
+ */
+static void receive(void)
+{
+    size_t len = 0;
+    size_t i = 0;
+
+    while (i < raw_len) {
+        uint8_t code = raw[i++];
+        if (code == 0 || i + code - 1 > raw_len) {
+            return;
+        }
+
+        for (uint8_t j = 1; j < code; ++j) {
+            frame[len++] = raw[i++];
+        }
+
+        if (code < 0xff && i < raw_len) {
+            frame[len++] = 0;
+        }
+    }
+
+    if (len < 5) {
+        return;
+    }
+
+    uint16_t crc = frame[len - 2] | (frame[len - 1] << 8);
+    if (crc16(0xffff, frame, len - 2) != crc) {
+        // Lost frames are detected by sequence numbers
+        return;
+    }
+
+    handle(frame[0] | (frame[1] << 8), frame[2], frame + 3, len - 5);
+}
+
+
+void boot_feed(uint8_t byte)
+{
+    if (byte == 0) {
+        if (!raw_overflow) {
+            receive();
+        }
+        raw_len = 0;
+        raw_overflow = 0;
+    } else if (raw_len < sizeof(raw)) {
+        raw[raw_len++] = byte;
+    } else {
+        raw_overflow = 1;
+    }
+}
+
+
+int boot_app_valid(void)
+{
+    const struct boot_info* info = (const struct boot_info*) BOOT_INFO_BASE;
+    const uint32_t* vt = (const uint32_t*) BOOT_APP_BASE;
+
+    // Initial stack pointer in RAM, reset handler (thumb) in the image
+    if (vt[0] <= 0x20000000 || vt[0] > 0x20005000
+            || !(vt[1] & 1) || vt[1] < BOOT_APP_BASE || vt[1] >= BOOT_APP_BASE + BOOT_APP_SIZE) {
+        return 0;
+    }
+
+    // Flashed with a debugger
+    if (info->magic == 0xffffffff) {
+        return 1;
+    }
+
+    if (info->magic != BOOT_INFO_MAGIC || info->valid != 0 || info->length > BOOT_APP_SIZE) {
+        return 0;
+    }
+
+    return crc32((const void*) BOOT_APP_BASE, info->length) == info->crc;
+}
@@ -0,0 +1,144 @@
+#ifndef __STM32F103C8_BOOT_H__
+#define __STM32F103C8_BOOT_H__
+
+#include <stdint.h>
+
+
+/*
+ * UART bootloader.
+ *
+ * Flash layout:
+ *
+ *   0x08000000  Bootloader (7 KiB, boot.ld)
+ *   0x08001c00  Image information (one page, struct boot_info)
+ *   0x08002000  Application (56 KiB, linker.ld)
+ *
+ * After reset, the bootloader jumps to the application unless an update
+ * is requested, either by the application (reset_bootloader() in
+ * reset.h) or by holding the reset button (PB0) during reset, or unless
+ * the application image fails verification.
+ *
+ * An application flashed with a debugger has no image information, and
+ * is started as long as its vector table looks sane.
+ */
+#define BOOT_APP_BASE       0x08002000
+#define BOOT_APP_SIZE       (56 * 1024)
+#define BOOT_INFO_BASE      0x08001c00
+
+
+/*
+ * Value in backup register 1 (BKP_DR1) requesting the bootloader to
+ * stay after the next reset.
+ */
+#define BOOT_REQUEST        0xb007
+
+
+/*
+ * Image information.
+ *
+ * Written in steps during an update, as flash bits can only be cleared:
+ * the page is erased and magic written before the image is programmed,
+ * length and crc are written after the image has been verified and
+ * valid is cleared last. An interrupted update leaves valid set.
+ */
+#define BOOT_INFO_MAGIC     0x544f4f42  // "BOOT"
+
+struct boot_info
+{
+    uint32_t magic;
+    uint32_t length;        // Image length in bytes
+    uint32_t crc;           // CRC-32 (zlib) of the image
+    uint32_t valid;         // 0 when the image is complete
+};
+
+
+/*
+ * Protocol.
+ *
+ * Requests and replies use the telemetry framing (see telemetry.h) in
+ * both directions on USART1 at BOOT_BAUD, 8N1.
+ *
+ * Every request is answered by a BOOT_REPLY frame:
+ *
+ *   type (1) | status (1, signed, 0 or -ERRNO) | seq (2, LE) | value (4, LE)
+ *
+ * where type and seq are those of the request.
+ *
+ * BOOT_HELLO   No payload. Value is the maximum image size.
+ *
+ * BOOT_BEGIN   length (4) | crc (4) | encoding (1)
+ *              Erases the pages needed for length bytes (may take a
+ *              second or so). The sequence number of this request is the
+ *              one before the first BOOT_DATA.
+ *
+ * BOOT_DATA    Next part of the (encoded) image, at most BOOT_DATA_MAX
+ *              bytes. The bootloader decodes and programs the data while
+ *              the following frames are received, so up to BOOT_WINDOW
+ *              frames may be sent before waiting for replies. A frame
+ *              with an unexpected sequence number is answered with
+ *              -EAGAIN and the expected sequence number as value, and the
+ *              sender must go back and resend from there.
+ *
+ * BOOT_END     No payload. Verifies the CRC of the programmed image and
+ *              completes the image information.
+ *
+ * BOOT_RUN     No payload. Resets and starts the application.
+ */
+#define BOOT_BAUD           1000000
+
+#define BOOT_HELLO          0x10
+#define BOOT_BEGIN          0x11
+#define BOOT_DATA           0x12
+#define BOOT_END            0x13
+#define BOOT_RUN            0x14
+#define BOOT_REPLY          0x20
+
+#define BOOT_DATA_MAX       256
+#define BOOT_WINDOW         4
+
+
+/*
+ * Image encodings.
+ *
+ * BOOT_LZ is the LZ4 block format: sequences of a token (literal length
+ * in the high nibble, match length - 4 in the low nibble, 15 meaning
+ * that more length bytes follow), literals, and a 16-bit LE offset back
+ * into the output. As in LZ4, the last sequence has literals only, and
+ * covers at least the last 5 bytes. Matches are read back from the flash
+ * already programmed, so the whole image is the window and no RAM is
+ * needed for it.
+ */
+#define BOOT_RAW            0
+#define BOOT_LZ             1
+
+
+/*
+ * The protocol and image decoder (boot.c) only reach the hardware through
+ * flash.h, crc32() and the functions below, so that they can be run on
+ * the host (see tools/bootemu.c). bootmain.c implements them for USART1.
+ */
+
+/*
+ * Feed one received byte to the protocol.
+ */
+void boot_feed(uint8_t byte);
+
+
+/*
+ * Returns non-zero if the application image can be started.
+ */
+int boot_app_valid(void);
+
+
+/*
+ * Send one byte, waiting until it can be written.
+ */
+void boot_putc(uint8_t byte);
+
+
+/*
+ * Reset the device, once the bytes sent have gone out.
+ */
+void boot_reset(void);
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "boot.h"
+#include "flash.h"
+#include "clock.h"
+#include "gpio.h"
+#include "usart.h"
+#include "dma.h"
+#include "pwr.h"
+#include "sys.h"
+
+#define RX_CHANNEL  5       // DMA1 channel for USART1_RX
+#define RX_SIZE     2048    // Receive ring, must hold BOOT_WINDOW frames
+
+
+/*
+ * Receive ring, written by DMA
+ */
+static uint8_t rx_ring[RX_SIZE];
+static uint16_t rx_tail;
+
+
+void boot_putc(uint8_t byte)
+{
+    while (!(usart1.sr & (1 << 7)));
+    usart1.dr = byte;
+}
+
+
+void boot_reset(void)
+{
+    // Let the reply go out first
+    while (!(usart1.sr & (1 << 6)));
+
+    __asm__ volatile ("dsb" ::: "memory");
+    scb.aircr = (0x05fa << 16) | (1 << 2);
+    while (1);
+}
+
+
+static void poll(void)
+{
+    uint16_t head = RX_SIZE - dma1.ch[RX_CHANNEL - 1].cndtr;
+
+    while (rx_tail != head) {
+        boot_feed(rx_ring[rx_tail]);
+        rx_tail = (rx_tail + 1) % RX_SIZE;
+    }
+}
+
+
+/*
+ * Set up USART1 with circular DMA reception, so that data keeps coming
+ * in while the CPU is stalled by flash programming.
+ */
+static void uart_init(void)
+{
+    uint32_t pclk = rcc_pclk2();
+
+    // Enable DMA1, GPIOA and USART1 clock
+    rcc.ahbenr |= 1;
+    rcc.apb2enr |= (1 << 14) | (1 << 2);
+
+    gpio_cfg(&gpioa, 9, GPIO_AFIO_PUSHPULL, GPIO_50MHZ);
+    gpio_cfg(&gpioa, 10, GPIO_HIGHIMP, GPIO_INPUT);
+
+    usart1.cr1 = 0;
+    usart1.brr = (pclk + BOOT_BAUD / 2) / BOOT_BAUD;
+    usart1.cr2 = 0;
+    usart1.cr3 = 1 << 6;        // DMA receiver
+
+    dma_start(&dma1, RX_CHANNEL, &usart1.dr, rx_ring, RX_SIZE,
+            DMA_MINC | DMA_CIRC | DMA_PRIO_HIGH);
+
+    usart1.cr1 = (1 << 13) | (1 << 3) | (1 << 2); // USART, transmitter and receiver enable
+}
+
+
+/*
+ * Has the application asked us to stay (see reset_bootloader())?
+ */
+static int requested(void)
+{
+    // Enable PWR and BKP clock
+    rcc.apb1enr |= (1 << 28) | (1 << 27);
+
+    if (bkp.dr[0] != BOOT_REQUEST) {
+        return 0;
+    }
+
+    pwr.cr |= 1 << 8;
+    bkp.dr[0] = 0;
+    pwr.cr &= ~(1 << 8);
+    return 1;
+}
+
+
+/*
+ * Is the reset button (PB0) held?
+ */
+static int button_held(void)
+{
+    // Enable port B clock
+    rcc.apb2enr |= 1 << 3;
+
+    // Input with pull-down (ODR is 0 after reset), the button pulls high
+    gpio_cfg(&gpiob, 0, GPIO_PULLUP, GPIO_INPUT);
+    for (volatile int i = 0; i < 100; ++i);
+
+    return in_b & 1;
+}
+
+
+static void start_app(void)
+{
+    const uint32_t* vt = (const uint32_t*) BOOT_APP_BASE;
+
+    // Leave clocks and port B as after reset
+    rcc.apb2rstr = 1 << 3;
+    rcc.apb2rstr = 0;
+    rcc.apb2enr = 0;
+    rcc.apb1enr = 0;
+    rcc.ahbenr = 0x14;
+
+    scb.vtor = BOOT_APP_BASE;
+    __asm__ volatile ("msr msp, %0\n\tbx %1" :: "r" (vt[0]), "r" (vt[1]) : "memory");
+
+    while (1);
+}
+
+
+int main()
+{
+    int stay = requested();
+    stay |= button_held();
+
+    if (!stay && boot_app_valid()) {
+        start_app();
+    }
+
+    rcc_sysclk(SYSCLK_HSE_9);
+    flash_unlock();
+    uart_init();
+
+    while (1) {
+        poll();
+    }
+}
@@ -0,0 +1,113 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include "clk.h"
+#include "clock.h"
+#include "irq.h"
+
+#define BUS(clk)    ((clk) >> 5)
+#define BIT(clk)    ((clk) & 0x1f)
+
+
+/*
+ * Enable and reset registers per bus
+ */
+static volatile uint32_t* const enr[3] = { &rcc.ahbenr, &rcc.apb1enr, &rcc.apb2enr };
+static volatile uint32_t* const rstr[3] = { NULL, &rcc.apb1rstr, &rcc.apb2rstr };
+
+
+/*
+ * References per clock, and clocks without references that are
+ * still running
+ */
+static uint8_t refs[3][32];
+static uint32_t idle[3];
+static uint32_t gated;
+
+
+void clk_get(enum clk clk)
+{
+    int bus = BUS(clk);
+    int bit = BIT(clk);
+
+    uint32_t primask = irq_save();
+    if (refs[bus][bit]++ == 0) {
+        idle[bus] &= ~(1 << bit);
+        *enr[bus] |= 1 << bit;
+
+        // Read back, so the clock is running before the peripheral is
+        // accessed (see section 2.3 in the STM32F10xx8 errata sheet)
+        (void) *enr[bus];
+    }
+    irq_restore(primask);
+}
+
+
+void clk_put(enum clk clk)
+{
+    int bus = BUS(clk);
+    int bit = BIT(clk);
+
+    uint32_t primask = irq_save();
+#ifndef NDEBUG
+    if (refs[bus][bit] == 0) {
+        irq_restore(primask);
+        return;
+    }
+#endif
+    if (--refs[bus][bit] == 0) {
+        idle[bus] |= 1 << bit;
+    }
+    irq_restore(primask);
+}
+
+
+void clk_gate(void)
+{
+    uint32_t primask = irq_save();
+    for (int bus = 0; bus < 3; ++bus) {
+        if (idle[bus] != 0) {
+            *enr[bus] &= ~idle[bus];
+            gated += __builtin_popcount(idle[bus]);
+            idle[bus] = 0;
+        }
+    }
+
+    // SRAM and flash interface clocks in sleep mode (SRAMEN and FLITFEN),
+    // which only DMA needs while the core sleeps
+    if (refs[BUS(CLK_DMA1)][BIT(CLK_DMA1)] == 0 && refs[BUS(CLK_DMA2)][BIT(CLK_DMA2)] == 0) {
+        rcc.ahbenr &= ~((1 << 4) | (1 << 2));
+    } else {
+        rcc.ahbenr |= (1 << 4) | (1 << 2);
+    }
+    irq_restore(primask);
+}
+
+
+int clk_reset(enum clk clk)
+{
+    int bus = BUS(clk);
+
+    if (rstr[bus] == NULL) {
+        return -EINVAL;
+    }
+
+    uint32_t primask = irq_save();
+    *rstr[bus] |= 1 << BIT(clk);
+    *rstr[bus] &= ~(1 << BIT(clk));
+    irq_restore(primask);
+
+    return 0;
+}
+
+
+void clk_snapshot(struct clk_snapshot* snapshot)
+{
+    uint32_t primask = irq_save();
+    for (int bus = 0; bus < 3; ++bus) {
+        snapshot->enabled[bus] = *enr[bus];
+        snapshot->idle[bus] = idle[bus];
+    }
+    snapshot->gated = gated;
+    irq_restore(primask);
+}
@@ -0,0 +1,112 @@
+#ifndef __STM32F103C8_CLK_H__
+#define __STM32F103C8_CLK_H__
+
+#include <stdint.h>
+
+
+/*
+ * Peripheral clock gating.
+ *
+ * Drivers take a reference on the clocks they need with clk_get() while
+ * they have work to do, and drop it with clk_put() when they go idle.
+ * A clock is enabled when its first reference is taken, but is not
+ * disabled when the last one is dropped; it is only marked idle, and all
+ * idle clocks are gated together by clk_gate() right before the core
+ * goes to sleep (see coro_loop() in coro.h). A driver that is busy again
+ * before that finds its clock still running.
+ *
+ * Peripheral registers keep their contents while the clock is gated, so
+ * a driver only has to hold a reference while the peripheral is running
+ * or its registers are accessed. Note that outputs driven by a GPIO port
+ * stay as they are, but input pins are not sampled without the clock.
+ *
+ * The SRAM and flash interface clocks, which are on after reset, are
+ * turned off in sleep mode unless DMA is in use. Clocks that are written
+ * directly through rcc (see clock.h) are left alone.
+ */
+#define _CLK(bus, bit)  (((bus) << 5) | (bit))
+enum clk
+{
+    CLK_DMA1    = _CLK(0,  0),  // AHB
+    CLK_DMA2    = _CLK(0,  1),
+    CLK_CRC     = _CLK(0,  6),
+
+    CLK_TIM2    = _CLK(1,  0),  // APB1
+    CLK_TIM3    = _CLK(1,  1),
+    CLK_TIM4    = _CLK(1,  2),
+    CLK_WWDG    = _CLK(1, 11),
+    CLK_SPI2    = _CLK(1, 14),
+    CLK_USART2  = _CLK(1, 17),
+    CLK_USART3  = _CLK(1, 18),
+    CLK_I2C1    = _CLK(1, 21),
+    CLK_I2C2    = _CLK(1, 22),
+    CLK_USB     = _CLK(1, 23),
+    CLK_CAN     = _CLK(1, 25),
+    CLK_BKP     = _CLK(1, 27),
+    CLK_PWR     = _CLK(1, 28),
+
+    CLK_AFIO    = _CLK(2,  0),  // APB2
+    CLK_GPIOA   = _CLK(2,  2),
+    CLK_GPIOB   = _CLK(2,  3),
+    CLK_GPIOC   = _CLK(2,  4),
+    CLK_GPIOD   = _CLK(2,  5),
+    CLK_ADC1    = _CLK(2,  9),
+    CLK_ADC2    = _CLK(2, 10),
+    CLK_TIM1    = _CLK(2, 11),
+    CLK_SPI1    = _CLK(2, 12),
+    CLK_USART1  = _CLK(2, 14),
+};
+#undef _CLK
+
+
+/*
+ * Take a reference on a peripheral clock, enabling it if necessary.
+ * May be called from any context.
+ */
+void clk_get(enum clk clk);
+
+
+/*
+ * Drop a reference taken with clk_get(). When the last reference is
+ * dropped, the clock is marked idle and gated by the next clk_gate().
+ * May be called from any context.
+ */
+void clk_put(enum clk clk);
+
+
+/*
+ * Gate all idle clocks, and the SRAM and flash interface in sleep mode
+ * unless DMA is in use. Called before sleeping, with interrupts disabled,
+ * so that no driver can take a reference in between.
+ */
+void clk_gate(void);
+
+
+/*
+ * Pulse the reset line of an APB peripheral, returning its registers to
+ * their reset values. The clock does not need to be enabled.
+ *
+ * Returns 0 on success, and -EINVAL for AHB peripherals, which have no
+ * reset line on this device.
+ */
+int clk_reset(enum clk clk);
+
+
+/*
+ * Clock state, indexed by bus (0 = AHB, 1 = APB1, 2 = APB2), with bits
+ * as in enum clk.
+ */
+struct clk_snapshot
+{
+    uint32_t enabled[3];    // Clocks currently running
+    uint32_t idle[3];       // Running, but without references
+    uint32_t gated;         // Number of times a clock has been gated
+};
+
+
+/*
+ * Take a consistent snapshot of the clock state.
+ */
+void clk_snapshot(struct clk_snapshot* snapshot);
+
+#endif
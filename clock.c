@@ -33,6 +33,12 @@
 extern volatile uint32_t _flash;
 
 
+/*
+ * Current SYSCLK frequency (HSI after reset)
+ */
+static int sysclk_freq = 8000000;
+
+
 /*
  * Set system clock (and APB1 prescale if necessary)
  */
@@ -115,5 +121,57 @@ int rcc_sysclk(enum sysclk clk)
     // Select SYSCLK
     rcc.cfgr |= clk & 0x3;
 
+    sysclk_freq = freq;
     return freq;
 }
+
+
+/*
+ * Get AHB clock frequency
+ * See section 7.3.2 in STM32F103xx MCU reference manual.
+ */
+int rcc_hclk(void)
+{
+    uint32_t hpre = (rcc.cfgr >> 4) & 0xf;
+
+    if (hpre < 8) {
+        return sysclk_freq;
+    } else if (hpre < 12) {
+        return sysclk_freq >> (hpre - 7);
+    }
+
+    // 1100 = /64, there is no /32 prescaler
+    return sysclk_freq >> (hpre - 6);
+}
+
+
+/*
+ * Get APB1 clock frequency
+ */
+int rcc_pclk1(void)
+{
+    uint32_t ppre = (rcc.cfgr >> 8) & 0x7;
+    return ppre < 4 ? rcc_hclk() : rcc_hclk() >> (ppre - 3);
+}
+
+
+/*
+ * Get APB2 clock frequency
+ */
+int rcc_pclk2(void)
+{
+    uint32_t ppre = (rcc.cfgr >> 11) & 0x7;
+    return ppre < 4 ? rcc_hclk() : rcc_hclk() >> (ppre - 3);
+}
+
+
+int rcc_timclk1(void)
+{
+    return rcc_pclk1() == rcc_hclk() ? rcc_hclk() : rcc_pclk1() * 2;
+}
+
+
+int rcc_timclk2(void)
+{
+    return rcc_pclk2() == rcc_hclk() ? rcc_hclk() : rcc_pclk2() * 2;
+}
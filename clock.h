@@ -103,4 +103,27 @@ enum sysclk
  */
 int rcc_sysclk(enum sysclk clk);
 
+
+/*
+ * Get the current bus clock frequencies.
+ *
+ * HCLK is the AHB clock (SYSCLK after the AHB prescaler), PCLK1 and PCLK2
+ * are the APB1 and APB2 peripheral clocks respectively. They are derived 
+ * from the prescalers currently set in RCC_CFGR, so they are valid after
+ * rcc_sysclk() has been called.
+ */
+int rcc_hclk(void);
+int rcc_pclk1(void);
+int rcc_pclk2(void);
+
+
+/*
+ * Get the timer clock frequencies for timers on APB1 (TIM2-TIM7) and
+ * APB2 (TIM1, TIM8). If the APB prescaler is not 1, the timer clock is
+ * twice the APB clock.
+ * See section 7.2 in STM32F103xx MCU reference manual.
+ */
+int rcc_timclk1(void);
+int rcc_timclk2(void);
+
 #endif
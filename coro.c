@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "coro.h"
+#include "atomic.h"
+#include "irq.h"
+#include "clk.h"
+
+
+volatile uint32_t coro_ticks;
+
+
+/*
+ * Runnable coroutines (FIFO)
+ */
+static struct coro* ready_head;
+static struct coro* ready_tail;
+
+
+/*
+ * Sleeping coroutines, sorted by wake tick
+ */
+static struct coro* sleeping;
+
+
+/*
+ * Coroutines waiting for events or flags, and the union of what they
+ * wait for, so the list is only scanned when one of them can wake.
+ */
+static struct coro* waiting;
+static uint32_t waiting_mask;
+
+
+/*
+ * Signalled, but not yet consumed, events
+ */
+static volatile uint32_t signals;
+
+
+static void make_ready(struct coro* c)
+{
+    c->next = NULL;
+    if (ready_tail != NULL) {
+        ready_tail->next = c;
+    } else {
+        ready_head = c;
+    }
+    ready_tail = c;
+}
+
+
+static void make_sleep(struct coro* c)
+{
+    struct coro** pos = &sleeping;
+
+    // Coroutines with the same wake tick keep their order
+    while (*pos != NULL && (int32_t) ((*pos)->wake - c->wake) <= 0) {
+        pos = &(*pos)->next;
+    }
+
+    c->next = *pos;
+    *pos = c;
+}
+
+
+static void make_wait(struct coro* c, uint32_t mask)
+{
+    c->next = waiting;
+    waiting = c;
+    waiting_mask |= mask;
+}
+
+
+/*
+ * Move waiting coroutines that can continue to the run queue.
+ */
+static void wake_waiters(void)
+{
+    uint32_t flags = coro_take(CORO_EVENT_FLAG);
+    struct coro** pos = &waiting;
+
+    waiting_mask = 0;
+
+    while (*pos != NULL) {
+        struct coro* c = *pos;
+
+        if (c->flag != NULL) {
+            if (flags && *c->flag != 0) {
+                *pos = c->next;
+                c->flag = NULL;
+                make_ready(c);
+                continue;
+            }
+            waiting_mask |= CORO_EVENT_FLAG;
+
+        } else {
+            uint32_t events = coro_take(c->events);
+            if (events != 0) {
+                *pos = c->next;
+                c->events = events;
+                make_ready(c);
+                continue;
+            }
+            waiting_mask |= c->events;
+        }
+
+        pos = &c->next;
+    }
+}
+
+
+static int runnable(void)
+{
+    return ready_head != NULL
+        || (sleeping != NULL && (int32_t) (coro_ticks - sleeping->wake) >= 0)
+        || (signals & waiting_mask) != 0;
+}
+
+
+void coro_start(struct coro* c, int (*fn)(struct coro* c), void* arg)
+{
+    c->fn = fn;
+    c->arg = arg;
+    c->line = 0;
+    c->flag = NULL;
+    make_ready(c);
+}
+
+
+void coro_tick(void)
+{
+    coro_ticks = coro_ticks + 1;
+}
+
+
+void coro_signal(uint32_t events)
+{
+    uint32_t old;
+    do {
+        old = signals;
+    } while (!atomic_cas(&signals, old, old | events));
+}
+
+
+uint32_t coro_take(uint32_t mask)
+{
+    uint32_t old;
+    do {
+        old = signals;
+        if ((old & mask) == 0) {
+            return 0;
+        }
+    } while (!atomic_cas(&signals, old, old & ~mask));
+
+    return old & mask;
+}
+
+
+void coro_set(volatile uint32_t* flag, uint32_t value)
+{
+    *flag = value;
+    coro_signal(CORO_EVENT_FLAG);
+}
+
+
+int coro_run(void)
+{
+    uint32_t now = coro_ticks;
+    int n = 0;
+
+    while (sleeping != NULL && (int32_t) (now - sleeping->wake) >= 0) {
+        struct coro* c = sleeping;
+        sleeping = c->next;
+        make_ready(c);
+    }
+
+    if (signals & waiting_mask) {
+        wake_waiters();
+    }
+
+    // Take the current run queue, so coroutines that yield are
+    // run again in the next pass, after the others
+    struct coro* c = ready_head;
+    ready_head = NULL;
+    ready_tail = NULL;
+
+    while (c != NULL) {
+        struct coro* next = c->next;
+
+        switch (c->fn(c)) {
+            case CORO_YIELD:
+                make_ready(c);
+                break;
+
+            case CORO_SLEEP:
+                make_sleep(c);
+                break;
+
+            case CORO_EVENT:
+                make_wait(c, c->events);
+                break;
+
+            case CORO_FLAG:
+                make_wait(c, CORO_EVENT_FLAG);
+                break;
+
+            default:
+                break;
+        }
+
+        c = next;
+        ++n;
+    }
+
+    return n;
+}
+
+
+void coro_loop(void)
+{
+    while (1) {
+        coro_run();
+
+        // WFI wakes up on a pending interrupt even when PRIMASK is set,
+        // so an interrupt between the check and WFI is not missed.
+        // Clocks that drivers have let go are gated while sleeping.
+        uint32_t primask = irq_save();
+        if (!runnable()) {
+            clk_gate();
+            __asm__ volatile ("wfi");
+        }
+        irq_restore(primask);
+    }
+}
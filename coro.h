@@ -0,0 +1,174 @@
+#ifndef __STM32F103C8_CORO_H__
+#define __STM32F103C8_CORO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/*
+ * Stackless cooperative coroutines.
+ *
+ * A coroutine is a function that is called again and again by the
+ * scheduler, and that resumes where it left off using a switch statement
+ * on the line number it last returned from (protothreads). All coroutines
+ * share the main stack, so the only per-coroutine state is the struct
+ * below. Local variables are NOT preserved across a wait, keep such state
+ * in static variables or in a struct reached through arg.
+ *
+ *   static int blink(struct coro* c)
+ *   {
+ *       CORO_BEGIN(c);
+ *       while (1) {
+ *           toggle_led();
+ *           await_ms(c, 500);
+ *       }
+ *       CORO_END(c);
+ *   }
+ *
+ * Every wait returns to the scheduler, so a wait can not be placed in a
+ * function called by the coroutine, nor inside a switch statement, and
+ * there can only be one wait per source line.
+ */
+struct coro
+{
+    int (*fn)(struct coro* c);
+    void* arg;
+    struct coro* next;                  // Run queue or wait list
+    uint32_t wake;                      // Tick to wake up at
+    uint32_t events;                    // Awaited, then received events
+    volatile const uint32_t* flag;      // Awaited flag
+    uint16_t line;                      // Resume point
+};
+
+
+/*
+ * Coroutine status returned to the scheduler.
+ */
+enum coro_status
+{
+    CORO_DONE       = 0,    // Finished, not run again
+    CORO_YIELD      = 1,    // Runnable, let others run first
+    CORO_SLEEP      = 2,    // Waiting for wake tick
+    CORO_EVENT      = 3,    // Waiting for one of the events
+    CORO_FLAG       = 4     // Waiting for flag to become non-zero
+};
+
+
+/*
+ * Event used internally to tell the scheduler that a flag has been set.
+ * Bits 0-30 may be used for application events.
+ */
+#define CORO_EVENT_FLAG     (1UL << 31)
+
+
+/*
+ * Millisecond tick, advanced by coro_tick().
+ */
+extern volatile uint32_t coro_ticks;
+
+
+#define CORO_BEGIN(c)   switch ((c)->line) { case 0:
+
+#define CORO_END(c)     } (c)->line = 0; return CORO_DONE
+
+#define _CORO_WAIT(c, status) \
+    (c)->line = __LINE__; return (status); case __LINE__:
+
+
+/*
+ * Let other runnable coroutines run, then continue.
+ */
+#define CORO_YIELD(c) \
+    do { _CORO_WAIT(c, CORO_YIELD); } while (0)
+
+
+/*
+ * Wait for ms ticks (milliseconds). The first tick may come at any time,
+ * so the wait is between ms - 1 and ms milliseconds long.
+ */
+#define await_ms(c, ms) \
+    do { \
+        (c)->wake = coro_ticks + (ms); \
+        _CORO_WAIT(c, CORO_SLEEP); \
+    } while (0)
+
+
+/*
+ * Wait until one of the events in mask has been signalled with
+ * coro_signal(). Events are latched until they are consumed by a waiting
+ * coroutine, so an event signalled before the wait is not lost. The
+ * events that were consumed are found in c->events afterwards.
+ */
+#define await_event(c, mask) \
+    do { \
+        if (((c)->events = coro_take(mask)) == 0) { \
+            (c)->events = (mask); \
+            _CORO_WAIT(c, CORO_EVENT); \
+        } \
+    } while (0)
+
+
+/*
+ * Wait until the flag *ptr is non-zero. The flag must be set with coro_set(),
+ * so that the scheduler knows to check it.
+ */
+#define await_flag(c, ptr) \
+    do { \
+        if (*(ptr) == 0) { \
+            (c)->flag = (ptr); \
+            _CORO_WAIT(c, CORO_FLAG); \
+        } \
+    } while (0)
+
+
+/*
+ * Add a coroutine to the run queue. The struct must stay valid until
+ * the coroutine has finished.
+ */
+void coro_start(struct coro* c, int (*fn)(struct coro* c), void* arg);
+
+
+/*
+ * Advance the tick. Call from the SysTick handler every millisecond.
+ */
+void coro_tick(void);
+
+
+/*
+ * Signal events, may be called from any context.
+ */
+void coro_signal(uint32_t events);
+
+
+/*
+ * Consume any of the events in mask that have been signalled.
+ * Returns the consumed events.
+ */
+uint32_t coro_take(uint32_t mask);
+
+
+/*
+ * Set a flag and let coroutines waiting for it run.
+ * May be called from any context.
+ */
+void coro_set(volatile uint32_t* flag, uint32_t value);
+
+
+/*
+ * Run every coroutine that is runnable once, in the order they became
+ * runnable. Coroutines that become runnable while doing so are run in
+ * the next call. Must be called from thread context.
+ *
+ * Returns the number of coroutines that were run.
+ */
+int coro_run(void);
+
+
+/*
+ * Run coroutines forever, sleeping (WFI) whenever no coroutine is
+ * runnable until an interrupt occurs. Idle peripheral clocks are gated
+ * before sleeping (see clk_gate() in clk.h).
+ */
+void coro_loop(void) __attribute__((noreturn));
+
+#endif
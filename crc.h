@@ -0,0 +1,73 @@
+#ifndef __STM32F103C8_CRC_H__
+#define __STM32F103C8_CRC_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/*
+ * CRC calculation unit.
+ * Section 4 in STM32F103xx MCU reference manual.
+ *
+ * The unit computes CRC-32 with polynomial 0x04c11db7 over 32-bit words,
+ * most significant bit first, starting from 0xffffffff. There is no input
+ * or output reflection and no final XOR. Since words are read from memory
+ * in little-endian order, this is NOT the same as CRC-32/MPEG-2 over the
+ * same bytes, unless the bytes in each word are swapped.
+ *
+ * The functions below take a reference on the unit clock while they use
+ * it (see clk.h), so the unit needs no initialization.
+ */
+struct crc
+{
+    uint32_t dr;        // Data register
+    uint32_t idr;       // Independent data (8-bit scratch register)
+    uint32_t cr;        // Control register
+};
+
+extern volatile struct crc crc;
+
+
+/*
+ * Compute the native CRC (see above) of count words.
+ * crc_words() starts from the initial value, crc_feed() continues from
+ * the current value. Both return the current value.
+ */
+uint32_t crc_words(const uint32_t* words, size_t count);
+uint32_t crc_feed(const uint32_t* words, size_t count);
+
+
+/*
+ * Compute the native CRC of count words using DMA (memory-to-memory on
+ * DMA1 channel 1), leaving the CPU free. Buffers larger than 65535 words
+ * are transferred in several blocks.
+ *
+ * The callback is called from the DMA interrupt handler with the result.
+ * The buffer must not be modified and the CRC unit must not be used until
+ * then. Returns 0 on success, -EBUSY if a transfer is already in progress,
+ * and -EINVAL on invalid arguments.
+ */
+int crc_dma(const uint32_t* words, size_t count,
+            void (*callback)(uint32_t value, void* arg), void* arg);
+
+int crc_dma_busy(void);
+
+
+/*
+ * Standard (zlib-compatible) CRC-32 of len bytes using the CRC unit.
+ *
+ * Input words and the result are bit-reversed (RBIT), which turns the
+ * unit's MSB-first CRC into the reflected CRC-32 used by zlib, Ethernet
+ * and PNG. The last len % 4 bytes are added in software.
+ * The buffer does not need to be aligned.
+ */
+uint32_t crc32(const void* buf, size_t len);
+
+
+/*
+ * Standard CRC-32 in software, same as zlib's crc32(value, buf, len).
+ * Start with value 0, and pass the result to continue with more data.
+ */
+uint32_t crc32_update(uint32_t value, const void* buf, size_t len);
+
+#endif
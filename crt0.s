@@ -13,6 +13,25 @@
 .thumb_func
 .global _reset
 _reset:
+    // Start the DWT cycle counter, so that main can tell how long it
+    // took to boot. The counter is not reset by a system reset, so the
+    // bootloader, which runs first after every reset, clears it. The
+    // application keeps counting, so that the time spent in the
+    // bootloader is included.
+    // (see section C1.6.5 and C1.8.8 in the ARMv7-M Architecture Reference Manual)
+    ldr     r1, demcr_addr
+    ldr     r2, [r1]
+    orr     r2, r2, $(1 << 24)  // DEMCR_TRCENA: enable DWT
+    str     r2, [r1]
+    ldr     r1, dwt_addr
+.ifdef BOOT
+    mov     r2, $0
+    str     r2, [r1, $4]    // DWT_CYCCNT = 0
+.endif
+    ldr     r2, [r1]
+    orr     r2, r2, $1      // DWT_CTRL_CYCCNTENA
+    str     r2, [r1]
+
     // Everything is flashed to ROM, RAM is unitialized at this point.
     // We need to copy values from ROM into RAM in order to initialize variables.
     ldr     r1, data_start // address of data section
@@ -23,10 +42,11 @@ _reset:
     subs    r3, r3, r1
     beq     init_bss        // if length = 0, skip copying
 
+    // The linker script aligns the sections, so copy whole words
 load_data:
-    ldrb    r4, [r2], $1    // read byte from ROM
-    strb    r4, [r1], $1    // write byte to RAM
-    subs    r3, r3, $1      // decrement length
+    ldr     r4, [r2], $4    // read word from ROM
+    str     r4, [r1], $4    // write word to RAM
+    subs    r3, r3, $4      // decrement length
     bgt     load_data       // repeat
 
 init_bss:
@@ -42,8 +62,8 @@ init_bss:
 
     mov     r2, $0
 zero_bss:
-    strb    r2, [r1], $1    // write zero byte
-    subs    r3, r3, $1      // decrement length
+    str     r2, [r1], $4    // write zero word
+    subs    r3, r3, $4      // decrement length
     bgt     zero_bss        // repeat
 
 relocate_vectors:
@@ -59,8 +79,10 @@ relocate_vectors:
     str     r1, [r2, r3]
 
     // Then, relocate the vector table by copying each vector
-    // from the original table to the new address
-    mov     r1, $0x0        // original table
+    // from the original table to the new address. The table is not
+    // necessarily at address 0, as the application is linked after the
+    // bootloader (see boot.ld).
+    ldr     r1, vt_addr     // original table
     ldr     r2, vtor_addr   // relocation address
     mov     r3, (_vt_end - _vt_start) / 4
 
@@ -98,7 +120,10 @@ data_end:   .word _data_end
 bss_start:  .word _bss_start
 bss_end:    .word _bss_end
 vtor_addr:  .word _vtor_addr 
+vt_addr:    .word _vt_start
 scb_addr:   .word scb
+dwt_addr:   .word dwt
+demcr_addr: .word 0xe000edfc
 
 
 /* 
@@ -0,0 +1,44 @@
+#include <stdint.h>
+#include <errno.h>
+#include "dma.h"
+
+
+/*
+ * Program and enable a DMA channel.
+ * See section 13.3.3 in STM32F103xx MCU reference manual.
+ */
+int dma_start(volatile struct dma* dma, int channel, volatile void* periph,
+              const volatile void* mem, uint16_t count, uint32_t flags)
+{
+#ifndef NDEBUG
+    if (!(1 <= channel && channel <= 7) || count == 0) {
+        return -EINVAL;
+    }
+#endif
+
+    volatile struct dma_channel* ch = &dma->ch[channel - 1];
+
+    // Channel registers can only be written while the channel is disabled
+    ch->ccr = 0;
+    dma_clear(dma, channel);
+
+    ch->cpar = (uint32_t) (uintptr_t) periph;
+    ch->cmar = (uint32_t) (uintptr_t) mem;
+    ch->cndtr = count;
+
+    // Configure and enable channel in one write
+    ch->ccr = (flags & 0x7ffe) | 1;
+
+    return 0;
+}
+
+
+uint16_t dma_stop(volatile struct dma* dma, int channel)
+{
+    volatile struct dma_channel* ch = &dma->ch[channel - 1];
+
+    ch->ccr &= ~1;
+    dma_clear(dma, channel);
+
+    return ch->cndtr;
+}
@@ -0,0 +1,102 @@
+#ifndef __STM32F103C8_DMA_H__
+#define __STM32F103C8_DMA_H__
+
+#include <stdint.h>
+
+
+/*
+ * Direct memory access controller (DMA)
+ * Section 13 in STM32F103xx MCU reference manual.
+ */
+struct dma_channel
+{
+    uint32_t ccr;       // Channel configuration
+    uint32_t cndtr;     // Number of data to transfer
+    uint32_t cpar;      // Peripheral address
+    uint32_t cmar;      // Memory address
+    uint32_t reserved;
+};
+
+
+struct dma
+{
+    uint32_t isr;               // Interrupt status register
+    uint32_t ifcr;              // Interrupt flag clear register
+    struct dma_channel ch[7];   // Channel 1-7 (ch[0] is channel 1)
+};
+
+
+/*
+ * Available DMA controllers
+ */
+extern volatile struct dma dma1;
+extern volatile struct dma dma2;
+
+
+/*
+ * Channel configuration bits (DMA_CCRx).
+ * See section 13.4.3 in the STM32F103xx MCU reference manual.
+ */
+enum dma_flags
+{
+    DMA_TCIE        = 1 << 1,   // Transfer complete interrupt enable
+    DMA_HTIE        = 1 << 2,   // Half transfer interrupt enable
+    DMA_TEIE        = 1 << 3,   // Transfer error interrupt enable
+    DMA_MEM2PERIPH  = 1 << 4,   // Read from memory (DIR=1)
+    DMA_CIRC        = 1 << 5,   // Circular mode
+    DMA_PINC        = 1 << 6,   // Peripheral address increment
+    DMA_MINC        = 1 << 7,   // Memory address increment
+    DMA_PSIZE_16    = 1 << 8,   // Peripheral size 16 bits (default 8)
+    DMA_PSIZE_32    = 2 << 8,   // Peripheral size 32 bits
+    DMA_MSIZE_16    = 1 << 10,  // Memory size 16 bits (default 8)
+    DMA_MSIZE_32    = 2 << 10,  // Memory size 32 bits
+    DMA_PRIO_MEDIUM = 1 << 12,  // Channel priority (default low)
+    DMA_PRIO_HIGH   = 2 << 12,
+    DMA_PRIO_MAX    = 3 << 12,
+    DMA_MEM2MEM     = 1 << 14,  // Memory to memory mode
+};
+
+
+/*
+ * Interrupt status bits for a channel, as returned by dma_status().
+ * See section 13.4.1 in the STM32F103xx MCU reference manual.
+ */
+#define DMA_GIF     1   // Global interrupt flag
+#define DMA_TCIF    2   // Transfer complete
+#define DMA_HTIF    4   // Half transfer
+#define DMA_TEIF    8   // Transfer error
+
+
+/*
+ * Convenience macro to get the interrupt status bits of a channel (1-7).
+ */
+#define dma_status(dma, channel) \
+    (((dma)->isr >> (((channel) - 1) * 4)) & 0xf)
+
+
+/*
+ * Convenience macro to clear all interrupt flags of a channel (1-7).
+ */
+#define dma_clear(dma, channel) \
+    do { \
+        (dma)->ifcr = 0xf << (((channel) - 1) * 4); \
+    } while (0)
+
+
+/*
+ * Set up and enable a transfer on the specified channel (1-7).
+ * The channel is disabled and its flags cleared before it is reprogrammed.
+ *
+ * Returns 0 on success, and -ERRNO on failure.
+ */
+int dma_start(volatile struct dma* dma, int channel, volatile void* periph,
+              const volatile void* mem, uint16_t count, uint32_t flags);
+
+
+/*
+ * Disable the specified channel (1-7) and clear its flags.
+ * Returns the number of data items that were not transferred.
+ */
+uint16_t dma_stop(volatile struct dma* dma, int channel);
+
+#endif
@@ -0,0 +1,287 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include "exti.h"
+#include "gpio.h"
+#include "timer.h"
+#include "clock.h"
+#include "clk.h"
+#include "irq.h"
+#include "sys.h"
+
+#define DEBOUNCE_FREQ   10000   // Debounce timer tick rate (Hz)
+
+
+/*
+ * Per-line state
+ */
+static struct
+{
+    void (*callback)(int line, void* arg);
+    void* arg;
+    uint16_t window;    // Debounce window in timer ticks (0 = off)
+    uint16_t deadline;  // Timer count when line is unmasked again
+} lines[16];
+
+
+/*
+ * Lines currently masked by the debouncer. TIM3 is only clocked while
+ * there are any.
+ */
+static uint32_t armed;
+
+
+/*
+ * Program TIM3 CC1 for the earliest debounce deadline.
+ * Must be called with interrupts disabled.
+ */
+static void rearm(void)
+{
+    uint16_t now = tim3.cnt;
+    uint16_t next = 0;
+    int32_t min = 0x7fff;
+
+    if (armed == 0) {
+        tim3.dier &= ~(1 << 1);
+        return;
+    }
+
+    for (uint32_t pending = armed; pending != 0; ) {
+        int line = 31 - __builtin_clz(pending);
+        pending &= ~(1 << line);
+
+        int16_t left = (int16_t) (lines[line].deadline - now);
+        if (left < min) {
+            min = left;
+            next = lines[line].deadline;
+        }
+    }
+
+    tim3.ccr[0] = next;
+    tim3.sr = ~(1 << 1);
+    tim3.dier |= 1 << 1;
+
+    // The deadline may have passed while we were busy,
+    // in which case the compare would not match until the counter wraps
+    if ((int16_t) (next - (uint16_t) tim3.cnt) <= 0) {
+        tim3.egr = 1 << 1;
+    }
+}
+
+
+/*
+ * TIM3 interrupt handler: unmask lines whose window has passed.
+ * Edges during the window have set the pending bit, so it is cleared
+ * before the line is unmasked.
+ */
+static void expire(void* arg)
+{
+    (void) arg;
+
+    uint32_t primask = irq_save();
+    uint32_t was_armed = armed;
+    uint16_t now = tim3.cnt;
+
+    tim3.sr = ~(1 << 1);
+
+    for (uint32_t pending = armed; pending != 0; ) {
+        int line = 31 - __builtin_clz(pending);
+        pending &= ~(1 << line);
+
+        if ((int16_t) (now - lines[line].deadline) >= 0) {
+            armed &= ~(1 << line);
+            exti.pr = 1 << line;
+            exti_unmask(line);
+        }
+    }
+
+    rearm();
+    if (was_armed != 0 && armed == 0) {
+        clk_put(CLK_TIM3);
+    }
+    irq_restore(primask);
+}
+
+
+/*
+ * EXTI interrupt handler, shared by every line of the vector.
+ *
+ * The lines belonging to the vector are passed as argument. Pending lines
+ * are found with CLZ, and each is acknowledged on its own by writing only
+ * its bit to PR (writing 1 clears, writing 0 has no effect).
+ */
+static void dispatch(void* arg)
+{
+    uint32_t pending = exti.pr & exti.imr & (uint32_t) (uintptr_t) arg;
+
+    while (pending != 0) {
+        int line = 31 - __builtin_clz(pending);
+        pending &= ~(1 << line);
+
+        exti.pr = 1 << line;
+
+        if (lines[line].window != 0) {
+            exti_mask(line);
+
+            uint32_t primask = irq_save();
+            if (armed == 0) {
+                clk_get(CLK_TIM3);
+            }
+            lines[line].deadline = tim3.cnt + lines[line].window;
+            armed |= 1 << line;
+            rearm();
+            irq_restore(primask);
+        }
+
+        if (lines[line].callback != NULL) {
+            lines[line].callback(line, lines[line].arg);
+        }
+    }
+}
+
+
+/*
+ * Enable external line interrupt.
+ * See section 10.2 and 10.3. in STM32F03xx MCU reference manual.
+ */
+int exti_enable(volatile struct gpio* port, int line, enum exti_trigger trig)
+{
+    // Set external interrupt configuration
+    // See section 9.4.3 - 9.4.6
+    uint32_t exticr = 0;
+    if (port == &gpioa) {
+        exticr = 0x0;
+    } else if (port == &gpiob) {
+        exticr = 0x1;
+    } else if (port == &gpioc) {
+        exticr = 0x2;
+    } else if (port == &gpiod) {
+        exticr = 0x3;
+    } else {
+        return -EINVAL;
+    }
+
+#ifndef NDEBUG
+    if (!(0 <= line && line <= 15)) {
+        return -EINVAL;
+    }
+#endif
+
+    // Enable input on pin
+    gpio_cfg(port, line, GPIO_PULLUP, GPIO_INPUT);
+
+    // Configure AFIO exti, four lines per register. The AFIO clock is
+    // only needed to access the register.
+    clk_get(CLK_AFIO);
+    afio.exticr[line / 4] &= ~(0xf << ((line % 4) * 4));
+    afio.exticr[line / 4] |= exticr << ((line % 4) * 4);
+    clk_put(CLK_AFIO);
+
+    // Set trigger selection (rising)
+    // section 10.3.3
+    exti.rtsr &= ~(1 << line);
+    exti.rtsr |= (trig & 1) << line;
+
+    // Set trigger selection (falling)
+    // section 10.3.4
+    exti.ftsr &= ~(1 << line);
+    exti.ftsr |= ((trig >> 1) & 1) << line;
+
+    // Discard any edge seen while configuring
+    exti.pr = 1 << line;
+    exti_unmask(line);
+
+    return 0;
+}
+
+
+int exti_attach(int line, void (*callback)(int line, void* arg), void* arg)
+{
+    int irq;
+    uint32_t vector_lines;
+
+#ifndef NDEBUG
+    if (!(0 <= line && line <= 15)) {
+        return -EINVAL;
+    }
+#endif
+
+    if (line < 5) {
+        irq = IRQ_EXTI0 + line;
+        vector_lines = 1 << line;
+    } else if (line < 10) {
+        irq = IRQ_EXTI9_5;
+        vector_lines = 0x03e0;
+    } else {
+        irq = IRQ_EXTI15_10;
+        vector_lines = 0xfc00;
+    }
+
+    uint32_t primask = irq_save();
+    lines[line].callback = callback;
+    lines[line].arg = arg;
+    irq_restore(primask);
+
+    irq_attach(irq, dispatch, (void*) (uintptr_t) vector_lines);
+    irq_enable(irq);
+
+    return 0;
+}
+
+
+void exti_mask(int line)
+{
+    BITBAND_PERIPH(exti.imr, line) = 0;
+}
+
+
+void exti_unmask(int line)
+{
+    BITBAND_PERIPH(exti.imr, line) = 1;
+}
+
+
+/*
+ * Set up TIM3 as a free-running 16-bit counter at DEBOUNCE_FREQ,
+ * using compare channel 1 for the debounce deadlines.
+ * See section 15.3 in STM32F103xx MCU reference manual.
+ */
+static void timer_init(void)
+{
+    clk_get(CLK_TIM3);
+
+    tim3.cr1 = 0;
+    tim3.psc = rcc_timclk1() / DEBOUNCE_FREQ - 1;
+    tim3.arr = 0xffff;
+    tim3.dier = 0;
+
+    // Load prescaler, then clear the update flag this causes
+    tim3.egr = 1;
+    tim3.sr = 0;
+
+    tim3.cr1 = 1;
+    clk_put(CLK_TIM3);
+
+    irq_attach(IRQ_TIM3, expire, NULL);
+    irq_enable(IRQ_TIM3);
+}
+
+
+int exti_debounce(int line, uint32_t ms)
+{
+    static int initialized = 0;
+
+#ifndef NDEBUG
+    if (!(0 <= line && line <= 15) || ms > 3000) {
+        return -EINVAL;
+    }
+#endif
+
+    if (ms > 0 && !initialized) {
+        timer_init();
+        initialized = 1;
+    }
+
+    lines[line].window = ms * (DEBOUNCE_FREQ / 1000);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef __STM32F103C8_EXTI_H__
+#define __STM32F103C8_EXTI_H__
+
+#include <stdint.h>
+#include "gpio.h"
+
+
+/*
+ * External interrupt/event (EXTI)
+ * See section 10.2 in STM32F103xx MCU reference manual.
+ */
+struct exti
+{
+    uint32_t imr;       // Interrupt mask
+    uint32_t emr;       // Event mask
+    uint32_t rtsr;      // Rising trigger selection
+    uint32_t ftsr;      // Falling trigger selection
+    uint32_t swier;     // Software interrupt event
+    uint32_t pr;        // Pending register
+};
+
+extern volatile struct exti exti;
+
+
+/*
+ * EXTI interrupt triggers.
+ * See section 10.3.3 and 10.3.4 in the STM32F103xx MCU reference manual.
+ */
+enum exti_trigger
+{
+    EXTI_TRIGGER_RISING     = 1,
+    EXTI_TRIGGER_FALLING    = 2,
+    EXTI_TRIGGER_BOTH       = 3
+};
+
+
+/*
+ * Enable EXTI interrupt on specified pin (line 0-15).
+ * This will implicitly set the GPIO pin to input and select the port in
+ * AFIO. The caller must hold a reference on the port clock (see clk.h)
+ * for as long as the line is used, as the pin is not sampled without it.
+ */
+int exti_enable(volatile struct gpio* port, int line, enum exti_trigger trig);
+
+
+/*
+ * Set callback for a line (0-15), called as callback(line, arg) from the
+ * line's interrupt handler.
+ *
+ * Lines 5-9 and 10-15 share one interrupt each. The shared handler
+ * acknowledges and dispatches every pending line, highest line first,
+ * so each callback is only called for its own line.
+ *
+ * The NVIC interrupt for the line is enabled. Returns 0 on success,
+ * and -ERRNO on failure.
+ */
+int exti_attach(int line, void (*callback)(int line, void* arg), void* arg);
+
+
+/*
+ * Mask (disable) and unmask (enable) interrupts from a line.
+ * These are single bit-band writes, so they are safe from any context.
+ */
+void exti_mask(int line);
+void exti_unmask(int line);
+
+
+/*
+ * Debounce a line.
+ *
+ * After an edge has been dispatched, the line is masked and a timer
+ * (TIM3) unmasks it again after the given window, so contact bounce
+ * during the window costs no interrupts at all. Edges seen while masked
+ * are discarded. A window of 0 turns debouncing off.
+ *
+ * The timer runs at 10 kHz, so the window can be at most 3000 ms.
+ * Returns 0 on success, and -ERRNO on failure.
+ */
+int exti_debounce(int line, uint32_t ms);
+
+#endif
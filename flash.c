@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include <errno.h>
+#include "flash.h"
+
+#define SR_BSY      (1 << 0)
+#define SR_PGERR    (1 << 2)
+#define SR_WRPRTERR (1 << 4)
+#define SR_EOP      (1 << 5)
+
+#define CR_PG       (1 << 0)
+#define CR_PER      (1 << 1)
+#define CR_STRT     (1 << 6)
+#define CR_LOCK     (1 << 7)
+
+
+/*
+ * Wait for the current operation to finish, and clear its status.
+ */
+static int wait(void)
+{
+    while (fpec.sr & SR_BSY);
+
+    uint32_t sr = fpec.sr;
+    fpec.sr = SR_EOP | SR_PGERR | SR_WRPRTERR;
+
+    return (sr & (SR_PGERR | SR_WRPRTERR)) ? -EIO : 0;
+}
+
+
+/*
+ * See section 3.1 in PM0075.
+ */
+void flash_unlock(void)
+{
+    if (fpec.cr & CR_LOCK) {
+        fpec.keyr = 0x45670123;
+        fpec.keyr = 0xcdef89ab;
+    }
+}
+
+
+void flash_lock(void)
+{
+    fpec.cr |= CR_LOCK;
+}
+
+
+/*
+ * See section 3.2.4 in PM0075.
+ */
+int flash_erase(uint32_t addr)
+{
+    wait();
+
+    fpec.cr |= CR_PER;
+    fpec.ar = addr;
+    fpec.cr |= CR_STRT;
+
+    int status = wait();
+    fpec.cr &= ~CR_PER;
+
+    return status;
+}
+
+
+/*
+ * See section 3.2.2 in PM0075.
+ */
+int flash_write(uint32_t addr, uint16_t value)
+{
+    wait();
+
+    fpec.cr |= CR_PG;
+    *(volatile uint16_t*) addr = value;
+
+    int status = wait();
+    fpec.cr &= ~CR_PG;
+
+    // Programming a half-word that was not erased is silently skipped
+    // (PGERR), so check that the value was written
+    if (status == 0 && *(volatile uint16_t*) addr != value) {
+        status = -EIO;
+    }
+
+    return status;
+}
@@ -0,0 +1,57 @@
+#ifndef __STM32F103C8_FLASH_H__
+#define __STM32F103C8_FLASH_H__
+
+#include <stdint.h>
+
+
+/*
+ * Flash program and erase controller (FPEC)
+ * Section 2.3 in STM32F10xxx Flash memory microcontrollers programming
+ * manual (PM0075).
+ */
+struct fpec
+{
+    uint32_t acr;       // Access control
+    uint32_t keyr;      // FPEC key
+    uint32_t optkeyr;   // Option byte key
+    uint32_t sr;        // Status register
+    uint32_t cr;        // Control register
+    uint32_t ar;        // Address register
+    uint32_t reserved;
+    uint32_t obr;       // Option byte register
+    uint32_t wrpr;      // Write protection register
+};
+
+extern volatile struct fpec fpec;
+
+
+/*
+ * Flash page size of medium-density devices
+ */
+#define FLASH_PAGE_SIZE     1024
+
+
+/*
+ * Unlock and lock the FPEC for erasing and programming.
+ */
+void flash_unlock(void);
+void flash_lock(void);
+
+
+/*
+ * Erase the page containing addr.
+ *
+ * The CPU stalls while flash is busy when running from flash, but DMA
+ * transfers to and from RAM continue.
+ * Returns 0 on success, and -EIO on failure.
+ */
+int flash_erase(uint32_t addr);
+
+
+/*
+ * Program a half-word at addr (must be aligned and erased).
+ * Returns 0 on success, and -EIO on failure.
+ */
+int flash_write(uint32_t addr, uint16_t value);
+
+#endif
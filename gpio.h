@@ -100,42 +100,4 @@ struct afio
 
 extern volatile struct afio afio;
 
-
-/*
- * External interrupt/event (EXTI)
- * See section 10.2 in STM32F103xx MCU reference manual.
- */
-struct exti 
-{
-    uint32_t imr;       // Interrupt mask
-    uint32_t emr;       // Event mask
-    uint32_t rtsr;      // Rising trigger selection
-    uint32_t ftsr;      // Falling trigger selection
-    uint32_t swier;     // Software interrupt event
-    uint32_t pr;        // Pending register
-};
-
-extern volatile struct exti exti;
-
-
-/*
- * EXTI interrupt triggers.
- * See section 10.3.3 and 10.3.4 in the STM32F103xx MCU reference manual.
- */ 
-enum exti_trigger
-{
-    EXTI_TRIGGER_RISING     = 1,
-    EXTI_TRIGGER_FALLING    = 2,
-    EXTI_TRIGGER_BOTH       = 3
-};
-
-
-/*
- * Enable EXTI interrupt on specified pin (line).
- * This will implicitly set the GPIO pin to input and enable AFIO.
- */
-int exti_enable(volatile struct gpio* port, int line, enum exti_trigger trig);
-
-
-// TODO: mask/unmask
 #endif
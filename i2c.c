@@ -0,0 +1,492 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include "i2c.h"
+#include "dma.h"
+#include "irq.h"
+#include "gpio.h"
+#include "clock.h"
+#include "clk.h"
+#include "sys.h"
+
+#define STOP_TIMEOUT    1000    // Microseconds
+
+
+/*
+ * Transaction state.
+ * Each state names the event the state machine is waiting for.
+ */
+enum state
+{
+    S_IDLE,
+    S_START,        // Waiting for SB (start sent)
+    S_ADDR_W,       // Waiting for ADDR (address + write acknowledged)
+    S_REG,          // Waiting for BTF (register address sent)
+    S_RESTART,      // Waiting for SB (repeated start sent)
+    S_ADDR_R,       // Waiting for ADDR (address + read acknowledged)
+    S_TX,           // Waiting for BTF (payload sent)
+    S_RX,           // Waiting for DMA TC or RXNE (payload received)
+};
+
+
+/*
+ * Per-I2C driver state.
+ */
+struct i2c_bus
+{
+    volatile struct i2c* i2c;
+    volatile struct gpio* port;
+    enum clk clk;                   // I2C clock
+    int scl;                        // SCL pin
+    int sda;                        // SDA pin
+    int tx_ch;                      // DMA1 channel for TX
+    int rx_ch;                      // DMA1 channel for RX
+    uint32_t cr2;                   // Saved configuration, used for bus recovery
+    uint32_t ccr;
+    uint32_t trise;
+    enum state state;
+    uint16_t pos;                   // Bytes transferred without DMA
+    struct i2c_xfer* head;          // Running transaction
+    struct i2c_xfer* tail;          // Last queued transaction
+};
+
+
+static struct i2c_bus buses[2] = {
+    { .i2c = &i2c1, .port = &gpiob, .clk = CLK_I2C1, .scl = 6, .sda = 7, .tx_ch = 6, .rx_ch = 7 },
+    { .i2c = &i2c2, .port = &gpiob, .clk = CLK_I2C2, .scl = 10, .sda = 11, .tx_ch = 4, .rx_ch = 5 },
+};
+
+
+static struct i2c_bus* get_bus(volatile struct i2c* i2c)
+{
+    if (i2c == &i2c1) {
+        return &buses[0];
+    } else if (i2c == &i2c2) {
+        return &buses[1];
+    }
+    return NULL;
+}
+
+
+/*
+ * Write configuration registers and enable peripheral.
+ * See section 26.3.3 in STM32F103xx MCU reference manual.
+ */
+static void configure(struct i2c_bus* bus)
+{
+    volatile struct i2c* i2c = bus->i2c;
+
+    i2c->cr1 = 0;
+    i2c->cr2 = bus->cr2;
+    i2c->ccr = bus->ccr;
+    i2c->trise = bus->trise;
+    i2c->cr1 = 1; // PE
+}
+
+
+/*
+ * Busy-wait roughly half an SCL period at 100 kHz (5 us).
+ */
+static void half_period(void)
+{
+    for (volatile int i = rcc_hclk() / 800000; i > 0; --i);
+}
+
+
+/*
+ * Recover from a stuck bus, i.e., after arbitration loss or bus error.
+ *
+ * A slave may still be driving SDA low in the middle of a byte. Take over
+ * the pins as GPIO and clock SCL until SDA is released (at most 9 clocks),
+ * then generate a STOP condition and reset the peripheral.
+ * See section 3.1.16 in the I2C-bus specification (UM10204).
+ */
+static void recover(struct i2c_bus* bus)
+{
+    volatile struct gpio* port = bus->port;
+
+    bus->i2c->cr1 = 0;
+
+    port->bssr = (1 << bus->scl) | (1 << bus->sda);
+    gpio_cfg(port, bus->scl, GPIO_OPENDRAIN, GPIO_2MHZ);
+    gpio_cfg(port, bus->sda, GPIO_OPENDRAIN, GPIO_2MHZ);
+
+    for (int i = 0; i < 9 && !(port->idr & (1 << bus->sda)); ++i) {
+        port->brr = 1 << bus->scl;
+        half_period();
+        port->bssr = 1 << bus->scl;
+        half_period();
+    }
+
+    // STOP: SDA low to high while SCL is high
+    port->brr = 1 << bus->scl;
+    half_period();
+    port->brr = 1 << bus->sda;
+    half_period();
+    port->bssr = 1 << bus->scl;
+    half_period();
+    port->bssr = 1 << bus->sda;
+    half_period();
+
+    gpio_cfg(port, bus->scl, GPIO_AFIO_OPENDRAIN, GPIO_2MHZ);
+    gpio_cfg(port, bus->sda, GPIO_AFIO_OPENDRAIN, GPIO_2MHZ);
+
+    // Software reset clears BUSY if the peripheral got confused
+    bus->i2c->cr1 = 1 << 15;
+    bus->i2c->cr1 = 0;
+
+    configure(bus);
+}
+
+
+/*
+ * Wait until the STOP condition has been sent, which takes a few
+ * microseconds unless a slave holds SCL low. The cycle counter is
+ * started by crt0.s.
+ *
+ * Returns 0 on success, -ETIMEDOUT after STOP_TIMEOUT.
+ */
+static int wait_stop(struct i2c_bus* bus)
+{
+    uint32_t start = dwt.cyccnt;
+    uint32_t timeout = rcc_hclk() / 1000000 * STOP_TIMEOUT;
+
+    while (bus->i2c->cr1 & (1 << 9)) {
+        if (dwt.cyccnt - start > timeout) {
+            return -ETIMEDOUT;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Clocks are only held while there are transactions queued. The port
+ * is needed for bus recovery.
+ */
+static void power_up(struct i2c_bus* bus)
+{
+    clk_get(CLK_DMA1);
+    clk_get(CLK_GPIOB);
+    clk_get(bus->clk);
+}
+
+
+static void power_down(struct i2c_bus* bus)
+{
+    clk_put(bus->clk);
+    clk_put(CLK_GPIOB);
+    clk_put(CLK_DMA1);
+}
+
+
+static void start(struct i2c_bus* bus)
+{
+    bus->pos = 0;
+    bus->state = S_START;
+    bus->i2c->cr1 |= 1 << 8;
+}
+
+
+/*
+ * Finish the running transaction, start the next queued one and invoke
+ * the callback for the finished one.
+ */
+static void complete(struct i2c_bus* bus, int status)
+{
+    volatile struct i2c* i2c = bus->i2c;
+    struct i2c_xfer* xfer = bus->head;
+
+    // Disable DMA requests and buffer interrupts
+    i2c->cr2 &= ~((1 << 12) | (1 << 11) | (1 << 10));
+
+    // A START requested before the STOP condition has been sent would be
+    // merged into a repeated start, and gating the clock would stop the
+    // STOP condition as well. This runs in interrupt context, so a slave
+    // holding SCL low must not keep us here.
+    if (wait_stop(bus) != 0) {
+        recover(bus);
+        if (status == 0) {
+            status = -ETIMEDOUT;
+        }
+    }
+
+    bus->state = S_IDLE;
+    bus->head = xfer->next;
+    if (bus->head != NULL) {
+        start(bus);
+    } else {
+        bus->tail = NULL;
+        power_down(bus);
+    }
+
+    xfer->status = status;
+    if (xfer->callback != NULL) {
+        xfer->callback(xfer, xfer->arg);
+    }
+}
+
+
+/*
+ * Event interrupt handler.
+ * See section 26.3.3 in STM32F103xx MCU reference manual, particularly
+ * Figure 273 (transfer sequence diagram for master transmitter) and
+ * Figure 276 (method 1 for master receiver).
+ */
+static void event(void* arg)
+{
+    struct i2c_bus* bus = arg;
+    volatile struct i2c* i2c = bus->i2c;
+    struct i2c_xfer* xfer = bus->head;
+    uint32_t sr1 = i2c->sr1;
+
+    if (xfer == NULL) {
+        return;
+    }
+
+    switch (bus->state) {
+        case S_START:
+            if (sr1 & 1) {
+                i2c->dr = xfer->addr << 1;
+                bus->state = S_ADDR_W;
+            }
+            break;
+
+        case S_ADDR_W:
+            if (sr1 & 2) {
+                (void) i2c->sr2; // Reading SR1 then SR2 clears ADDR
+
+                i2c->dr = xfer->reg;
+                if (xfer->read || xfer->len < 2) {
+                    bus->state = S_REG;
+                } else {
+                    // DMA refills DR on TXE, BTF is set after the last byte
+                    i2c->cr2 |= 1 << 11;
+                    dma_start(&dma1, bus->tx_ch, &i2c->dr, xfer->buf, xfer->len,
+                            DMA_MEM2PERIPH | DMA_MINC);
+                    bus->state = S_TX;
+                }
+            }
+            break;
+
+        case S_REG:
+            if (sr1 & 4) {
+                if (xfer->read) {
+                    i2c->cr1 |= 1 << 8;
+                    bus->state = S_RESTART;
+                } else if (xfer->len == 1) {
+                    i2c->dr = xfer->buf[0];
+                    bus->pos = 1;
+                    bus->state = S_TX;
+                } else {
+                    i2c->cr1 |= 1 << 9;
+                    complete(bus, 0);
+                }
+            }
+            break;
+
+        case S_RESTART:
+            if (sr1 & 1) {
+                i2c->dr = (xfer->addr << 1) | 1;
+                if (xfer->len >= 2) {
+                    // ACK all bytes, LAST makes hardware NACK the final byte
+                    i2c->cr1 |= 1 << 10;
+                    i2c->cr2 |= (1 << 12) | (1 << 11);
+                    dma_start(&dma1, bus->rx_ch, &i2c->dr, xfer->buf, xfer->len,
+                            DMA_MINC | DMA_TCIE | DMA_PRIO_HIGH);
+                }
+                bus->state = S_ADDR_R;
+            }
+            break;
+
+        case S_ADDR_R:
+            if (sr1 & 2) {
+                if (xfer->len == 1) {
+                    // Single byte: NACK and STOP must be set up
+                    // before ADDR is cleared
+                    i2c->cr1 &= ~(1 << 10);
+                    (void) i2c->sr2;
+                    i2c->cr1 |= 1 << 9;
+                    i2c->cr2 |= 1 << 10;
+                } else {
+                    (void) i2c->sr2;
+                }
+                bus->state = S_RX;
+            }
+            break;
+
+        case S_TX:
+            if (sr1 & 4) {
+                if (bus->pos == 0) {
+                    dma_stop(&dma1, bus->tx_ch);
+                }
+                i2c->cr1 |= 1 << 9;
+                complete(bus, 0);
+            }
+            break;
+
+        case S_RX:
+            if (sr1 & (1 << 6)) {
+                xfer->buf[0] = i2c->dr;
+                complete(bus, 0);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/*
+ * Error interrupt handler.
+ * See section 26.3.4 in STM32F103xx MCU reference manual.
+ */
+static void error(void* arg)
+{
+    struct i2c_bus* bus = arg;
+    volatile struct i2c* i2c = bus->i2c;
+    uint32_t sr1 = i2c->sr1;
+    int status = -EIO;
+
+    // Error flags are cleared by writing zero
+    i2c->sr1 = sr1 & ~((1 << 14) | (1 << 11) | (1 << 10) | (1 << 9) | (1 << 8));
+
+    dma_stop(&dma1, bus->tx_ch);
+    dma_stop(&dma1, bus->rx_ch);
+
+    if (sr1 & ((1 << 9) | (1 << 8))) {
+        // Arbitration lost or misplaced start/stop
+        status = (sr1 & (1 << 9)) ? -EAGAIN : -EIO;
+        recover(bus);
+    } else if (sr1 & (1 << 10)) {
+        // Acknowledge failure, release the bus
+        status = -ENXIO;
+        i2c->cr1 |= 1 << 9;
+    } else {
+        i2c->cr1 |= 1 << 9;
+    }
+
+    if (bus->head != NULL) {
+        complete(bus, status);
+    }
+}
+
+
+/*
+ * DMA receive complete: the last byte has been NACKed, send STOP.
+ */
+static void rx_done(void* arg)
+{
+    struct i2c_bus* bus = arg;
+
+    dma_stop(&dma1, bus->rx_ch);
+    bus->i2c->cr1 |= 1 << 9;
+    complete(bus, 0);
+}
+
+
+/*
+ * Initialize I2C in master mode.
+ * See section 26.6.8 and 26.6.9 in STM32F103xx MCU reference manual
+ * for how CCR and TRISE are calculated.
+ */
+int i2c_init(volatile struct i2c* i2c, uint32_t speed)
+{
+    struct i2c_bus* bus = get_bus(i2c);
+
+    if (bus == NULL || speed == 0 || speed > 400000) {
+        return -EINVAL;
+    }
+
+    int pclk = rcc_pclk1();
+    int mhz = pclk / 1000000;
+    if (mhz < 2 || (speed > 100000 && mhz < 4)) {
+        return -EINVAL;
+    }
+
+    clk_get(CLK_GPIOB);
+    clk_get(bus->clk);
+
+    // Event and error interrupts
+    bus->cr2 = (1 << 9) | (1 << 8) | mhz;
+
+    if (speed > 100000) {
+        // Fast mode, Tlow/Thigh = 2
+        uint32_t ccr = pclk / (speed * 3);
+        bus->ccr = (1 << 15) | (ccr < 1 ? 1 : ccr);
+        bus->trise = mhz * 300 / 1000 + 1;
+    } else {
+        // Standard mode, Tlow/Thigh = 1
+        uint32_t ccr = pclk / (speed * 2);
+        bus->ccr = ccr < 4 ? 4 : ccr;
+        bus->trise = mhz + 1;
+    }
+
+    bus->state = S_IDLE;
+    bus->head = NULL;
+    bus->tail = NULL;
+
+    gpio_cfg(bus->port, bus->scl, GPIO_AFIO_OPENDRAIN, GPIO_2MHZ);
+    gpio_cfg(bus->port, bus->sda, GPIO_AFIO_OPENDRAIN, GPIO_2MHZ);
+
+    configure(bus);
+
+    clk_put(bus->clk);
+    clk_put(CLK_GPIOB);
+
+    if (i2c == &i2c1) {
+        irq_attach(IRQ_I2C1_EV, event, bus);
+        irq_attach(IRQ_I2C1_ER, error, bus);
+        irq_attach(IRQ_DMA1_Channel7, rx_done, bus);
+        irq_enable(IRQ_I2C1_EV);
+        irq_enable(IRQ_I2C1_ER);
+        irq_enable(IRQ_DMA1_Channel7);
+    } else {
+        irq_attach(IRQ_I2C2_EV, event, bus);
+        irq_attach(IRQ_I2C2_ER, error, bus);
+        irq_attach(IRQ_DMA1_Channel5, rx_done, bus);
+        irq_enable(IRQ_I2C2_EV);
+        irq_enable(IRQ_I2C2_ER);
+        irq_enable(IRQ_DMA1_Channel5);
+    }
+
+    return 0;
+}
+
+
+int i2c_submit(volatile struct i2c* i2c, struct i2c_xfer* xfer)
+{
+    struct i2c_bus* bus = get_bus(i2c);
+
+#ifndef NDEBUG
+    if (bus == NULL || xfer == NULL || (xfer->read && xfer->len == 0)) {
+        return -EINVAL;
+    }
+#endif
+
+    xfer->next = NULL;
+    xfer->status = -EINPROGRESS;
+
+    uint32_t primask = irq_save();
+    if (bus->tail != NULL) {
+        bus->tail->next = xfer;
+        bus->tail = xfer;
+    } else {
+        power_up(bus);
+        bus->head = xfer;
+        bus->tail = xfer;
+        start(bus);
+    }
+    irq_restore(primask);
+
+    return 0;
+}
+
+
+int i2c_busy(volatile struct i2c* i2c)
+{
+    struct i2c_bus* bus = get_bus(i2c);
+    return bus != NULL && bus->head != NULL;
+}
@@ -0,0 +1,88 @@
+#ifndef __STM32F103C8_I2C_H__
+#define __STM32F103C8_I2C_H__
+
+#include <stdint.h>
+
+
+/*
+ * Inter-integrated circuit interface (I2C)
+ * Section 26 in STM32F103xx MCU reference manual.
+ */
+struct i2c
+{
+    uint32_t cr1;       // Control register 1
+    uint32_t cr2;       // Control register 2
+    uint32_t oar1;      // Own address register 1
+    uint32_t oar2;      // Own address register 2
+    uint32_t dr;        // Data register
+    uint32_t sr1;       // Status register 1
+    uint32_t sr2;       // Status register 2
+    uint32_t ccr;       // Clock control register
+    uint32_t trise;     // Rise time register
+};
+
+
+/*
+ * Available I2Cs
+ */
+extern volatile struct i2c i2c1;
+extern volatile struct i2c i2c2;
+
+
+/*
+ * I2C register transaction.
+ *
+ * A write sends the register address followed by len bytes from buf.
+ * A read sends the register address, then issues a repeated start and
+ * reads len bytes into buf. addr is the 7-bit slave address.
+ *
+ * The structure is owned by the driver from i2c_submit() until the callback
+ * is invoked (from interrupt context). status is 0 on success, -ENXIO if
+ * the slave did not acknowledge, -EAGAIN if arbitration was lost,
+ * -ETIMEDOUT if the STOP condition could not be sent (e.g., a slave held
+ * SCL low) and -EIO on other bus errors. The bus is recovered after
+ * arbitration loss, bus errors and timeouts.
+ */
+struct i2c_xfer
+{
+    uint8_t addr;                   // 7-bit slave address
+    uint8_t reg;                    // Register address
+    uint8_t read;                   // Non-zero for register read
+    uint8_t* buf;                   // Data buffer
+    uint16_t len;                   // Number of bytes (read must be >= 1)
+    void (*callback)(struct i2c_xfer* xfer, void* arg);
+    void* arg;                      // Callback argument
+    int status;                     // Completion status
+    struct i2c_xfer* next;          // Used by the driver
+};
+
+
+/*
+ * Initialize I2C as master with the given bus speed (up to 400 kHz).
+ * I2C1 uses pins PB6 (SCL) and PB7 (SDA), and DMA1 channel 6 (TX) and 7 (RX).
+ * I2C2 uses pins PB10 (SCL) and PB11 (SDA), and DMA1 channel 4 (TX) and 5 (RX),
+ * which means it can not be used together with SPI2.
+ *
+ * Returns 0 on success, and -ERRNO on failure.
+ */
+int i2c_init(volatile struct i2c* i2c, uint32_t speed);
+
+
+/*
+ * Queue a transaction.
+ *
+ * Transactions are run in order from the event interrupt, payloads of two
+ * bytes or more are transferred with DMA. May be called from interrupt
+ * context, including from a callback.
+ *
+ * Returns 0 on success, and -ERRNO on failure.
+ */
+int i2c_submit(volatile struct i2c* i2c, struct i2c_xfer* xfer);
+
+
+/*
+ * Returns non-zero if there are queued or running transactions.
+ */
+int i2c_busy(volatile struct i2c* i2c);
+
+#endif
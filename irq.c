@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include "irq.h"
+#include "sys.h"
+
+
+/*
+ * Handler table used by the dispatch stub, indexed by exception number
+ * (16 + IRQ number). The argument comes first so that both can be loaded
+ * into r0 (first argument) and r2 with a single LDM.
+ */
+struct irq_entry
+{
+    void* arg;
+    void (*handler)(void* arg);
+};
+
+struct irq_entry irq_table[16 + NUM_IRQ];
+
+
+/*
+ * Number of preemption priority bits (reset default is all four).
+ */
+static int preempt_bits = 4;
+
+
+/*
+ * Dispatch stub placed in the vector table for handlers set with irq_attach().
+ *
+ * On exception entry, the hardware has already stacked r0-r3, r12, LR, PC
+ * and xPSR, and LR holds the EXC_RETURN value. So we only need to look up
+ * the entry for the active exception (IPSR) and branch to the handler with
+ * the argument in r0; the handler then returns directly to the exception
+ * return:
+ *
+ *   mrs   1 cycle
+ *   movw  1 cycle
+ *   movt  1 cycle
+ *   add   1 cycle
+ *   ldm   3 cycles
+ *   bx    3 cycles (pipeline refill)
+ *
+ * See section 2.3.7 in STM32F10xxx Cortex-M3 programming manual.
+ */
+__attribute__((naked)) static void irq_dispatch(void)
+{
+    __asm__ volatile (
+        "mrs    r0, ipsr\n\t"
+        "movw   r1, #:lower16:irq_table\n\t"
+        "movt   r1, #:upper16:irq_table\n\t"
+        "add    r1, r1, r0, lsl #3\n\t"
+        "ldm    r1, {r0, r2}\n\t"
+        "bx     r2\n\t"
+    );
+}
+
+
+int irq_attach(int irq, void (*handler)(void* arg), void* arg)
+{
+#ifndef NDEBUG
+    if (!(IRQ_NMI <= irq && irq < NUM_IRQ) || handler == NULL) {
+        return -EINVAL;
+    }
+#endif
+
+    // Update the table before the vector, in case the interrupt is
+    // already enabled and pending
+    irq_table[16 + irq].arg = arg;
+    irq_table[16 + irq].handler = handler;
+    __asm__ volatile ("dmb" ::: "memory");
+
+    irq_set_handler(irq, irq_dispatch);
+
+    return 0;
+}
+
+
+void irq_detach(int irq)
+{
+    irq_set_handler(irq, 0);
+    irq_table[16 + irq].handler = NULL;
+    irq_table[16 + irq].arg = NULL;
+}
+
+
+int irq_taken(int irq, void (*handler)(void* arg), void* arg)
+{
+    void (*vector)(void) = ((void (**)(void)) scb.vtor)[16 + irq];
+
+    if (vector == NULL) {
+        return 0;
+    }
+
+    return vector != irq_dispatch || irq_table[16 + irq].handler != handler
+        || irq_table[16 + irq].arg != arg;
+}
+
+
+/*
+ * Set PRIGROUP in AIRCR.
+ * Only the upper four bits of the priority fields are implemented, so
+ * PRIGROUP 0-3 all give four preemption bits.
+ * See section 4.4.5 in STM32F10xxx Cortex-M3 programming manual.
+ */
+int irq_set_grouping(int bits)
+{
+#ifndef NDEBUG
+    if (!(0 <= bits && bits <= 4)) {
+        return -EINVAL;
+    }
+#endif
+
+    // Writes to AIRCR must include the key 0x05fa
+    scb.aircr = (0x05fa << 16) | ((7 - bits) << 8);
+    preempt_bits = bits;
+
+    return 0;
+}
+
+
+/*
+ * Set interrupt or system handler priority.
+ * See section 4.3.7 and 4.4.8 in STM32F10xxx Cortex-M3 programming manual.
+ */
+int irq_set_priority(int irq, int preempt, int sub)
+{
+    int sub_bits = 4 - preempt_bits;
+
+#ifndef NDEBUG
+    if (!(0 <= preempt && preempt < (1 << preempt_bits))
+            || !(0 <= sub && sub < (1 << sub_bits))) {
+        return -EINVAL;
+    }
+#endif
+
+    uint8_t priority = ((preempt << sub_bits) | sub) << 4;
+
+    if (irq >= 0 && irq < NUM_IRQ) {
+        nvic.ipr[irq] = priority;
+    } else if (IRQ_MemManage <= irq && irq < 0) {
+        // SHPR1-3 hold priorities for exception 4-15
+        scb.shpr[16 + irq - 4] = priority;
+    } else {
+        // NMI and HardFault have fixed priorities
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+
+int irq_enable(int irq)
+{
+#ifndef NDEBUG
+    if (!(0 <= irq && irq < NUM_IRQ)) {
+        return -EINVAL;
+    }
+#endif
+
+    uint32_t bit = 1 << (irq % 32);
+    int enabled = !!(nvic.iser[irq / 32] & bit);
+
+    nvic.iser[irq / 32] = bit;
+    return enabled;
+}
+
+
+int irq_disable(int irq)
+{
+#ifndef NDEBUG
+    if (!(0 <= irq && irq < NUM_IRQ)) {
+        return -EINVAL;
+    }
+#endif
+
+    uint32_t bit = 1 << (irq % 32);
+    int enabled = !!(nvic.iser[irq / 32] & bit);
+
+    nvic.icer[irq / 32] = bit;
+
+    // Make sure the interrupt is disabled before returning
+    __asm__ volatile ("dsb\n\tisb" ::: "memory");
+    return enabled;
+}
@@ -0,0 +1,165 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "log.h"
+#include "telemetry.h"
+#include "atomic.h"
+
+#define MASK    (LOG_BUFFER_WORDS - 1)
+
+#if (LOG_BUFFER_WORDS & MASK) != 0
+#error "LOG_BUFFER_WORDS must be a power of two"
+#endif
+
+
+/*
+ * Log ring buffer.
+ *
+ * Writers reserve space by advancing head with compare-and-swap, fill in the
+ * arguments and then commit the message by writing its header word last.
+ * The reader consumes messages from tail as long as the header is non-zero
+ * and clears every word it consumes, so a reserved but not yet committed
+ * message stops the reader until it is committed.
+ */
+static struct
+{
+    volatile uint32_t head;     // Next word to reserve
+    volatile uint32_t tail;     // Next word to read
+    volatile uint32_t dropped;  // Messages dropped since last read
+    volatile uint32_t buf[LOG_BUFFER_WORDS];
+} ring;
+
+
+/*
+ * Reserve n words in the ring. Returns 0 if the buffer is full.
+ */
+static int reserve(uint32_t n, uint32_t* pos)
+{
+    uint32_t head;
+
+    do {
+        head = ring.head;
+        if (head + n - ring.tail > LOG_BUFFER_WORDS) {
+            atomic_add(&ring.dropped, 1);
+            return 0;
+        }
+    } while (!atomic_cas(&ring.head, head, head + n));
+
+    *pos = head;
+    return 1;
+}
+
+
+void log_write(uint32_t header, uint32_t a, uint32_t b, uint32_t c)
+{
+    uint32_t n = header & 0xf;
+    uint32_t pos;
+
+    if (!reserve(n, &pos)) {
+        return;
+    }
+
+    switch (n) {
+        case 4:
+            ring.buf[(pos + 3) & MASK] = c;
+            // fall through
+        case 3:
+            ring.buf[(pos + 2) & MASK] = b;
+            // fall through
+        case 2:
+            ring.buf[(pos + 1) & MASK] = a;
+            // fall through
+        default:
+            break;
+    }
+
+    atomic_barrier();
+    ring.buf[pos & MASK] = header;
+}
+
+
+void log_writev(uint32_t header, const uint32_t* args)
+{
+    uint32_t n = header & 0xf;
+    uint32_t pos;
+
+    if (!reserve(n, &pos)) {
+        return;
+    }
+
+    for (uint32_t i = 1; i < n; ++i) {
+        ring.buf[(pos + i) & MASK] = args[i - 1];
+    }
+
+    atomic_barrier();
+    ring.buf[pos & MASK] = header;
+}
+
+
+uint32_t log_read(uint32_t* dst, uint32_t max)
+{
+    uint32_t tail = ring.tail;
+    uint32_t count = 0;
+
+    // Report dropped messages first, so the host knows there is a gap
+    if (ring.dropped != 0 && max >= 2) {
+        dst[count++] = ((uint32_t) LOG_ID_DROPPED << 16) | 2;
+        dst[count++] = atomic_xchg(&ring.dropped, 0);
+    }
+
+    while (1) {
+        uint32_t header = ring.buf[tail & MASK];
+        uint32_t n = header & 0xf;
+
+        if (header == 0 || count + n > max) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < n; ++i) {
+            dst[count++] = ring.buf[(tail + i) & MASK];
+            ring.buf[(tail + i) & MASK] = 0;
+        }
+        tail += n;
+
+        // Words must be cleared before writers can reserve them again
+        atomic_barrier();
+        ring.tail = tail;
+    }
+
+    return count;
+}
+
+
+static uint32_t flush_buf[LOG_BUFFER_WORDS];
+static struct telemetry_frame flush_frame;
+static volatile int flush_busy;
+
+
+static void flush_done(struct telemetry_frame* frame, void* arg)
+{
+    (void) frame;
+    (void) arg;
+    flush_busy = 0;
+}
+
+
+int log_flush(void)
+{
+    if (flush_busy) {
+        return 0;
+    }
+
+    uint32_t n = log_read(flush_buf, LOG_BUFFER_WORDS);
+    if (n == 0) {
+        return 0;
+    }
+
+    flush_busy = 1;
+    flush_frame.type = TELEMETRY_LOG;
+    flush_frame.data = flush_buf;
+    flush_frame.len = n * sizeof(uint32_t);
+    flush_frame.callback = flush_done;
+    flush_frame.arg = NULL;
+    telemetry_send(&flush_frame);
+
+    return n;
+}
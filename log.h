@@ -0,0 +1,126 @@
+#ifndef __STM32F103C8_LOG_H__
+#define __STM32F103C8_LOG_H__
+
+#include <stdint.h>
+
+
+/*
+ * Deferred-formatting binary logger.
+ *
+ * LOG("adc=%u threshold=%u", sample, threshold);
+ *
+ * The format string is placed in the .logfmt section, which the linker
+ * script keeps in the ELF file but never loads into flash. The offset of
+ * the string in that section is a link-time constant and serves as the
+ * message ID. A log call only stores the ID and the raw arguments as
+ * 32-bit words in a lock-free ring buffer; formatting happens on the host
+ * (see tools/logdec.c), which looks the strings up in the ELF file.
+ *
+ * Arguments are passed as 32-bit integers, so only integer, character and
+ * pointer conversions are supported. %s is only meaningful for pointers
+ * to constant strings in flash, which the host reads from the ELF file.
+ * At most 6 arguments are supported.
+ *
+ * LOG() may be called from any context, including interrupt handlers of
+ * any priority. If the buffer is full, the message is dropped and counted.
+ */
+#define LOG(...) \
+    _LOG_SELECT(__VA_ARGS__, _LOG6, _LOG5, _LOG4, _LOG3, _LOG2, _LOG1, _LOG0, _)(__VA_ARGS__)
+
+
+/*
+ * Size of the log buffer in 32-bit words (must be a power of two).
+ * Every message uses one word for the header plus one word per argument.
+ */
+#ifndef LOG_BUFFER_WORDS
+#define LOG_BUFFER_WORDS    256
+#endif
+
+
+/*
+ * Message ID reserved for the "messages dropped" record, which carries
+ * the number of dropped messages as its only argument.
+ */
+#define LOG_ID_DROPPED      0xffff
+
+
+/*
+ * Store a message with up to three arguments (header encodes the ID
+ * and number of words), and with an argument array respectively.
+ */
+void log_write(uint32_t header, uint32_t a, uint32_t b, uint32_t c);
+void log_writev(uint32_t header, const uint32_t* args);
+
+
+/*
+ * Copy committed messages from the log buffer into dst (at most
+ * max words). Messages are never split. Must only be called from
+ * one context at a time.
+ *
+ * Returns the number of words copied.
+ */
+uint32_t log_read(uint32_t* dst, uint32_t max);
+
+
+/*
+ * Send buffered messages as a TELEMETRY_LOG frame.
+ *
+ * Returns the number of words queued for transmission, 0 if there was
+ * nothing to send or the previous flush is still being transmitted.
+ * Must be called from thread context.
+ */
+int log_flush(void);
+
+
+
+/*
+ * Implementation details of LOG()
+ */
+#define _LOG_SELECT(_0, _1, _2, _3, _4, _5, _6, name, ...) name
+
+#define _LOG_FMT(fmt) \
+    static const char _log_fmt[] __attribute__((section(".logfmt"), used)) = fmt
+
+#define _LOG_HEADER(nargs) \
+    (((uint32_t) (uintptr_t) _log_fmt << 16) | ((nargs) + 1))
+
+#define _LOG0(fmt) \
+    do { _LOG_FMT(fmt); log_write(_LOG_HEADER(0), 0, 0, 0); } while (0)
+
+#define _LOG1(fmt, a) \
+    do { _LOG_FMT(fmt); log_write(_LOG_HEADER(1), (uint32_t) (a), 0, 0); } while (0)
+
+#define _LOG2(fmt, a, b) \
+    do { _LOG_FMT(fmt); log_write(_LOG_HEADER(2), (uint32_t) (a), (uint32_t) (b), 0); } while (0)
+
+#define _LOG3(fmt, a, b, c) \
+    do { \
+        _LOG_FMT(fmt); \
+        log_write(_LOG_HEADER(3), (uint32_t) (a), (uint32_t) (b), (uint32_t) (c)); \
+    } while (0)
+
+#define _LOG4(fmt, a, b, c, d) \
+    do { \
+        _LOG_FMT(fmt); \
+        const uint32_t _log_args[] = { (uint32_t) (a), (uint32_t) (b), (uint32_t) (c), \
+            (uint32_t) (d) }; \
+        log_writev(_LOG_HEADER(4), _log_args); \
+    } while (0)
+
+#define _LOG5(fmt, a, b, c, d, e) \
+    do { \
+        _LOG_FMT(fmt); \
+        const uint32_t _log_args[] = { (uint32_t) (a), (uint32_t) (b), (uint32_t) (c), \
+            (uint32_t) (d), (uint32_t) (e) }; \
+        log_writev(_LOG_HEADER(5), _log_args); \
+    } while (0)
+
+#define _LOG6(fmt, a, b, c, d, e, f) \
+    do { \
+        _LOG_FMT(fmt); \
+        const uint32_t _log_args[] = { (uint32_t) (a), (uint32_t) (b), (uint32_t) (c), \
+            (uint32_t) (d), (uint32_t) (e), (uint32_t) (f) }; \
+        log_writev(_LOG_HEADER(6), _log_args); \
+    } while (0)
+
+#endif
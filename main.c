@@ -1,31 +1,41 @@
 #include "irq.h"
 #include "adc.h"
 #include "gpio.h"
-#include "usart.h"
+#include "exti.h"
 #include "clock.h"
+#include "telemetry.h"
+#include "log.h"
+#include "atomic.h"
+#include "reset.h"
+#include "coro.h"
+#include "crc.h"
+#include "clk.h"
+#include "task.h"
+#include "spi.h"
 #include <stddef.h>
 #include <stdint.h>
 
 static int red_pin = 12;
 static int green_pin = 13;
+static struct seqlock pins_lock; // Protects red_pin and green_pin
 static volatile uint16_t threshold; // Potentiometer threshold value
 
+#define EVENT_SWAP      (1 << 0)    // Swap button pressed
+#define EVENT_RESET     (1 << 1)    // Reset button pressed
 
+static volatile uint32_t started;   // Start-up sequence has been played
+static volatile int leds_busy;      // LED sequence is playing
+static volatile uint16_t sample;    // Latest potentiometer sample
+static volatile uint32_t sampled;   // First sample has been taken
 
-static void uart_send(volatile struct usart* usart, const char* str)
-{
-    usart->cr1 |= 0 << 3;
-    usart->cr1 |= 1 << 3;
+static int warm;                    // Warm boot (see reset.h)
+static int clk_speed;
+static uint32_t hsi_cycles;         // Cycles spent running on HSI
 
-    const char* p = str;
-    while (*p != '\0') {
-        while (!(usart->sr & (1 << 7)));
-        usart->dr = *p;
-        ++p;
-    }
+static struct coro coros[3];        // leds, report and bench
+static struct task control_task;    // 1 kHz
+static struct task blink_task;      // 4 Hz
 
-    while (!(usart->sr & (1 << 6)));
-}
 
 
 /*
@@ -33,6 +43,8 @@ static void uart_send(volatile struct usart* usart, const char* str)
  */
 static uint16_t adc_read(volatile struct adc* adc, int channel)
 {
+    clk_get(CLK_ADC1);
+
     // One conversion 
     adc->sqr1 &= 0xff000000;
 
@@ -48,86 +60,104 @@ static uint16_t adc_read(volatile struct adc* adc, int channel)
 
     // Reading the data register will clear EOC
     uint16_t data = adc->dr & 0xffff;
+    clk_put(CLK_ADC1);
 
     // Remove some granularity from sample
     return data >> 9;
 }
 
 
-static void delay(uint32_t ms)
+static void toggle_led()
 {
-    for (uint32_t i = 0; i < ms; ++i) {
-        while (!(systick.ctrl & (1 << 16)));
-    }
+    clk_get(CLK_GPIOC);
+    out_c = (out_c & ~(1 << 13)) | ~(out_c & (1 << 13));
+    clk_put(CLK_GPIOC);
 }
 
 
-static void toggle_led()
+/*
+ * Consistent snapshot of the pins, in case button_swap() runs
+ */
+static void read_pins(int* red, int* green)
 {
-    out_c = (out_c & ~(1 << 13)) | ~(out_c & (1 << 13));
+    uint32_t seq;
+
+    do {
+        seq = seqlock_read_begin(&pins_lock);
+        *red = red_pin;
+        *green = green_pin;
+    } while (seqlock_read_retry(&pins_lock, seq));
 }
 
 
-static void flash_alternate(int n, int speed)
+static void adc_calibrate(volatile struct adc* adc)
 {
-    uint32_t value = out_b & ((1 << green_pin) | (1 << red_pin));
+    adc->cr2 |= 1 << 3;
+    while (adc->cr2 & (1 << 3));
+    adc->cr2 |= 1 << 2;
+    while (adc->cr2 & (1 << 2));
+}
 
-    for (int i = 0; i < n; ++i) {
-        out_b &= ~(1 << green_pin);
-        out_b |= 1 << red_pin;
-        delay(speed);
-        out_b &= ~(1 << red_pin);
-        out_b |= 1 << green_pin;
-        delay(speed);
-    }
 
-    out_b |= value;
+/*
+ * Remember the operating point across warm boots.
+ */
+static void save_state(void)
+{
+    uint32_t primask = irq_save();
+    reset_record.data[0] = threshold;
+    reset_record.data[1] = red_pin | (green_pin << 8);
+    reset_save();
+    irq_restore(primask);
 }
 
 
-static void flash_both(int n, int speed)
+/*
+ * Restore the operating point saved before the reset.
+ * Returns 0 if there is no valid state to restore.
+ */
+static int restore_state(void)
 {
-    uint32_t value = out_b & ((1 << green_pin) | (1 << red_pin));
+    uint32_t red = reset_record.data[1] & 0xff;
+    uint32_t green = reset_record.data[1] >> 8;
 
-    for (int i = 0; i < n; ++i) {
-        out_b &= ~((1 << green_pin) | (1 << red_pin));
-        delay(speed);
-        out_b |= (1 << green_pin) | (1 << red_pin);
-        delay(speed);
+    // Do not trust values from a differently configured image
+    if (red == green || !(red == 12 || red == 13) || !(green == 12 || green == 13)) {
+        return 0;
     }
 
-    out_b |= value;
+    red_pin = red;
+    green_pin = green;
+    threshold = reset_record.data[0];
+    return 1;
 }
 
 
-static void adc_calibrate(volatile struct adc* adc)
+static void button_swap(int line, void* arg)
 {
-    adc->cr2 |= 1 << 3;
-    while (adc->cr2 & (1 << 3));
-    adc->cr2 |= 1 << 2;
-    while (adc->cr2 & (1 << 2));
-}
-
+    (void) line;
+    (void) arg;
 
-static void button_swap()
-{
+    uint32_t basepri = critical_enter(2);
+    seqlock_write_begin(&pins_lock);
     int tmp = green_pin;
     green_pin = red_pin;
     red_pin = tmp;
-    exti.pr |= 1;
+    seqlock_write_end(&pins_lock);
+    critical_exit(basepri);
+    save_state();
 
-    uart_send(&usart1, "swap\r\n");
-    flash_alternate(6, 100);
+    LOG("swap");
+    coro_signal(EVENT_SWAP);
 }
 
 
-static void button_reset()
+static void button_reset(int line, void* arg)
 {
-    threshold = adc_read(&adc1, 0);
-    exti.pr |= 2;
+    (void) line;
+    (void) arg;
 
-    uart_send(&usart1, "reset\r\n");
-    flash_both(6, 100);
+    coro_signal(EVENT_RESET);
 }
 
 
@@ -135,38 +165,356 @@ void systick_handler(void)
 {
     static int ms = 0;
 
+    coro_tick();
+
     if (++ms == 1000) {
-        uart_send(&usart1, "second\r\n");
+        LOG("second");
         ms = 0;
     }
 }
 
 
+/*
+ * Play LED sequences: alternating at start-up (cold boot only) and when
+ * the pins are swapped, both LEDs when the threshold is reset.
+ */
+static int leds(struct coro* c)
+{
+    static int i, n, both;
+    static uint32_t value;
+    int red, green;
+
+    CORO_BEGIN(c);
+
+    n = warm ? 0 : 5;
+    both = 0;
+
+    while (1) {
+        leds_busy = 1;
+        value = out_b & ((1 << green_pin) | (1 << red_pin));
+
+        for (i = 0; i < n; ++i) {
+            read_pins(&red, &green);
+            if (both) {
+                out_b &= ~((1 << green) | (1 << red));
+            } else {
+                out_b &= ~(1 << green);
+                out_b |= 1 << red;
+            }
+            await_ms(c, 100);
+
+            read_pins(&red, &green);
+            if (both) {
+                out_b |= (1 << green) | (1 << red);
+            } else {
+                out_b &= ~(1 << red);
+                out_b |= 1 << green;
+            }
+            await_ms(c, 100);
+        }
+
+        out_b |= value;
+        leds_busy = 0;
+        coro_set(&started, 1);
+
+        await_event(c, EVENT_SWAP | EVENT_RESET);
+
+        both = !!(c->events & EVENT_RESET);
+        if (both) {
+            // The ADC belongs to control()
+            threshold = sample;
+            save_state();
+            LOG("reset threshold=%u", threshold);
+        }
+        n = 6;
+    }
+
+    CORO_END(c);
+}
+
+
+/*
+ * Compare the potentiometer to the threshold (periodic task).
+ */
+static void control(void* arg)
+{
+    int red, green;
+
+    (void) arg;
+
+    if (!started) {
+        return;
+    }
+
+    read_pins(&red, &green);
+    int value = (1 << red) | (1 << green);
+
+    sample = adc_read(&adc1, 0);
+
+    if (!sampled) {
+        // Reset-to-first-sample latency, including the bootloader (see
+        // crt0.s). Cycles before the SYSCLK switch are at 8 MHz.
+        uint32_t cycles = dwt.cyccnt - hsi_cycles;
+        uint32_t us = hsi_cycles / 8 + cycles / (clk_speed / 1000000);
+
+        LOG("%s boot: flags=%x warm_boots=%u adc_cal=%u first sample after %u us",
+                warm ? "warm" : "cold", reset_record.flags >> 24,
+                reset_record.warm_boots, reset_record.adc_cal, us);
+        coro_set(&sampled, 1);
+    }
+    if (sample < threshold) {
+        value = 1 << red;
+    } else if (sample > threshold) {
+        value = 1 << green;
+    }
+
+    if (!leds_busy) {
+        out_b = value;
+    }
+}
+
+
+static void blink(void* arg)
+{
+    (void) arg;
+    toggle_led();
+}
+
+
+static void log_task(const char* name, const struct task* t)
+{
+    struct task_stats stats;
+
+    task_stats(t, &stats);
+    LOG("%s: exec max %u avg %u us, jitter max %u us", name,
+            stats.exec_max, stats.exec_avg, stats.jitter_max);
+    LOG("%s: %u runs, %u deadline misses, %u skipped", name,
+            stats.runs, stats.misses, stats.skipped);
+}
+
+
+/*
+ * Send log messages over USART1, and which clocks are running and the
+ * task timing every ten seconds.
+ */
+static int report(struct coro* c)
+{
+    static int n;
+    struct clk_snapshot clocks;
+
+    CORO_BEGIN(c);
+
+    while (1) {
+        if (++n == 100) {
+            clk_snapshot(&clocks);
+            LOG("clocks ahb=%x apb1=%x apb2=%x", clocks.enabled[0],
+                    clocks.enabled[1], clocks.enabled[2]);
+            LOG("clocks gated %u times", clocks.gated);
+            log_task("control", &control_task);
+            log_task("blink", &blink_task);
+            n = 0;
+        }
+
+        log_flush();
+        await_ms(c, 100);
+    }
+
+    CORO_END(c);
+}
+
+
+/*
+ * Compare the CRC paths on the start of the flash image.
+ */
+static void crc_bench(void)
+{
+    const uint32_t* image = (const uint32_t*) 0x08000000;
+    const uint32_t len = 8192;
+
+    uint32_t start = dwt.cyccnt;
+    uint32_t sw = crc32_update(0, image, len);
+    uint32_t sw_cycles = dwt.cyccnt - start;
+
+    start = dwt.cyccnt;
+    uint32_t hw = crc32(image, len);
+    uint32_t hw_cycles = dwt.cyccnt - start;
+
+    start = dwt.cyccnt;
+    crc_words(image, len / 4);
+    uint32_t word_cycles = dwt.cyccnt - start;
+
+    start = dwt.cyccnt;
+    crc_dma(image, len / 4, NULL, NULL);
+    while (crc_dma_busy());
+    uint32_t dma_cycles = dwt.cyccnt - start;
+
+    LOG("crc32 %u bytes: software %u cycles, unit %u cycles (%s)",
+            len, sw_cycles, hw_cycles, sw == hw ? "match" : "MISMATCH");
+    LOG("crc native %u bytes: words %u cycles, dma %u cycles",
+            len, word_cycles, dma_cycles);
+}
+
+
+/*
+ * Interrupt entry latency, from the software trigger to the first
+ * instruction of the handler. TIM4 is otherwise unused.
+ */
+static volatile uint32_t irq_entered;
+
+
+static void latency_direct(void)
+{
+    irq_entered = dwt.cyccnt;
+}
+
+
+static void latency_attached(void* arg)
+{
+    (void) arg;
+    irq_entered = dwt.cyccnt;
+}
+
+
+static uint32_t irq_latency(void)
+{
+    uint32_t min = UINT32_MAX;
+
+    // Best of a few, in case SysTick gets in between
+    for (int i = 0; i < 16; ++i) {
+        uint32_t start = dwt.cyccnt;
+        nvic.stir = IRQ_TIM4;
+        __asm__ volatile ("dsb\n\tisb" ::: "memory");
+
+        uint32_t cycles = irq_entered - start;
+        if (cycles < min) {
+            min = cycles;
+        }
+    }
+
+    return min;
+}
+
+
+/*
+ * Compare a direct vector to irq_dispatch() (see irq_attach()).
+ */
+static void irq_bench(void)
+{
+    irq_enable(IRQ_TIM4);
+
+    irq_set_handler(IRQ_TIM4, latency_direct);
+    uint32_t direct = irq_latency();
+
+    irq_attach(IRQ_TIM4, latency_attached, NULL);
+    uint32_t attached = irq_latency();
+
+    irq_disable(IRQ_TIM4);
+    irq_detach(IRQ_TIM4);
+
+    LOG("irq entry: direct %u cycles, irq_attach %u cycles", direct, attached);
+}
+
+
+#ifdef SPI_LOOPBACK
+/*
+ * Send a pattern over SPI1 and check that it comes back, which needs
+ * MOSI (PA7) connected to MISO (PA6). Only built with SPI_LOOPBACK, as
+ * it drives pins that may be wired to other hardware.
+ */
+static void spi_bench(void)
+{
+    static uint8_t tx[256];
+    static uint8_t rx[256];
+    static struct spi_xfer xfer;
+
+    for (unsigned i = 0; i < sizeof(tx); ++i) {
+        tx[i] = i * 37 + 1;
+        rx[i] = 0;
+    }
+
+    int freq = spi_init(&spi1, 18000000, SPI_MODE0);
+
+    xfer = (struct spi_xfer) { .tx = tx, .rx = rx, .len = sizeof(tx) };
+
+    uint32_t start = dwt.cyccnt;
+    spi_submit(&spi1, &xfer);
+    while (spi_busy(&spi1));
+    uint32_t cycles = dwt.cyccnt - start;
+
+    int errors = xfer.status != 0;
+    for (unsigned i = 0; i < sizeof(tx); ++i) {
+        errors += rx[i] != tx[i];
+    }
+
+    // Bytes per millisecond is kB/s
+    LOG("spi1 loopback %u bytes at %u Hz: %u cycles/byte, %u kB/s (%s)",
+            sizeof(tx), freq, cycles / sizeof(tx),
+            sizeof(tx) * (clk_speed / 1000) / cycles,
+            errors == 0 ? "match" : "MISMATCH, is PA7 connected to PA6?");
+}
+#endif
+
+
+/*
+ * Cost of interrupt dispatch, of the CRC paths, of SPI throughput and of
+ * a yield and resume. Run once the first sample has been taken, so that
+ * the benchmarks do not add to the boot latency. The other coroutines
+ * are waiting meanwhile, so every yield is one switch.
+ */
+static int bench(struct coro* c)
+{
+    static int i;
+    static uint32_t start;
+
+    CORO_BEGIN(c);
+
+    await_flag(c, &sampled);
+
+    irq_bench();
+    crc_bench();
+#ifdef SPI_LOOPBACK
+    spi_bench();
+#endif
+
+    start = dwt.cyccnt;
+    for (i = 0; i < 1000; ++i) {
+        CORO_YIELD(c);
+    }
+    LOG("coroutine switch: %u cycles", (dwt.cyccnt - start) / 1000);
+
+    CORO_END(c);
+}
+
+
 int main()
 {
-    int clk_speed = rcc_sysclk(SYSCLK_HSE_9);
+    // After a watchdog or software reset, the state from before the
+    // reset is used and the start-up delays are skipped
+    warm = reset_init();
+
+    // The HSE and PLL are off after any reset, so this can not be skipped.
+    // Until SYSCLK is switched, the core runs from HSI (8 MHz).
+    clk_speed = rcc_sysclk(SYSCLK_HSE_9);
+    hsi_cycles = dwt.cyccnt;
 
     // Enable SysTick interrupts
     // TODO: TIM5 interrupts for delay/counter
-    // TODO: events instead of interrupts (delaying in irq routine doesn't work becaus irqs block)
     irq_set_handler(IRQ_SysTick, systick_handler);
     // TODO: use systick for preemptive scheduling
     systick.load = clk_speed / 8 / 1000;
     systick.ctrl |= 2 | 1;
     //systick.ctrl |= 1;
 
-    // Enable port clocks (PA + PB + PC)
-    rcc.apb2enr |= (1 << 4) | (1 << 3) | (1 << 2);
-
-    // Enable ADC1 clock
-    rcc.apb2enr |= 1 << 9;
+    // Port B is used all the time for the buttons and the LEDs, the other
+    // clocks are taken when needed and gated when idle (see clk.h)
+    clk_get(CLK_GPIOA);
+    clk_get(CLK_GPIOB);
+    clk_get(CLK_GPIOC);
+    clk_get(CLK_ADC1);
 
     // Power on ADC by setting ADON
     adc1.cr2 |= 1;
 
-    // Enable AFIO clock for EXTI interrupts
-    rcc.apb2enr |= 1;
-
     // Enable input on PA0
     gpio_cfg(&gpioa, 0, GPIO_ANALOG, GPIO_INPUT);
 
@@ -175,59 +523,59 @@ int main()
     gpio_cfg(&gpiob, green_pin, GPIO_PUSHPULL, GPIO_2MHZ);
     gpio_cfg(&gpioc, 13, GPIO_PUSHPULL, GPIO_2MHZ);
 
-    // After a reset, the ADC requires calibration
-    adc_calibrate(&adc1);
+    clk_put(CLK_GPIOA);
+    clk_put(CLK_GPIOC);
 
-    // Set up custom EXTI interrupt vectors
-    irq_set_handler(IRQ_EXTI0, button_reset);
-    irq_set_handler(IRQ_EXTI1, button_swap);
+    // After a power-on reset, the ADC requires calibration. The code can
+    // not be written back to the ADC, but its offset is far below the
+    // granularity of adc_read(), so a warm boot runs without calibration.
+    if (!warm) {
+        adc_calibrate(&adc1);
+        reset_record.adc_cal = adc1.dr;
+    }
+    clk_put(CLK_ADC1);
+
+    // All four priority bits are used for preemption, so button_reset()
+    // may preempt button_swap(), but never the other way around
+    irq_set_grouping(4);
+    irq_set_priority(IRQ_EXTI0, 2, 0);
+    irq_set_priority(IRQ_EXTI1, 3, 0);
 
-    // Set interrupt priorities (I have no idea what I'm doing here)
-    irq_set_priority(IRQ_EXTI0, 2);
-    irq_set_priority(IRQ_EXTI1, 3);
+    // Task releases may preempt the buttons, the tasks themselves run
+    // below every interrupt, the 1 kHz task above the 4 Hz task
+    // (see task.h)
+    irq_set_priority(IRQ_TIM2, 1, 0);
 
-    // Set up EXTI line interrupts for pins
+    // Set up EXTI line interrupts for pins, ignoring contact bounce
     exti_enable(&gpiob, 0, EXTI_TRIGGER_RISING);
     exti_enable(&gpiob, 1, EXTI_TRIGGER_RISING);
+    exti_debounce(0, 50);
+    exti_debounce(1, 50);
 
-    // Take initial sample
-    threshold = adc_read(&adc1, 0);
+    // Take initial sample, unless restoring the previous operating point
+    if (!warm || !restore_state()) {
+        threshold = adc_read(&adc1, 0);
+    }
+    save_state();
 
     // Enable interrupts
-    irq_enable(IRQ_EXTI0);
-    irq_enable(IRQ_EXTI1);
-
-    // Enable USART2 clock
-    //rcc.apb1enr |= 1 << 17;
-    rcc.apb2enr |= 1 << 14;
-
-    // Set PA9 to TX and PA10 to RX
-    // Ref section 9.1.11
-    //gpio_enable(&gpioa, 10, 2, 0);
-    gpio_cfg(&gpioa, 9, GPIO_AFIO | GPIO_PUSHPULL, GPIO_50MHZ);
-
-    // Test UART transmit
-    usart1.cr1 |= 1 << 13; // USART enable
-    usart1.cr1 |= 0 << 12; // 8 data bits
-    usart1.cr1 |= 0 << 9;  // Even parity
-    usart1.cr2 |= 2 << 12; // 2 stop bits
-    usart1.brr = clk_speed / 115200;    // Baud rate 115200
-
-    flash_alternate(5, 100);
-
-    while (1) {
-        int value = (1 << red_pin) | (1 << green_pin);
-
-        uint16_t sample = adc_read(&adc1, 0);
-        if (sample < threshold) {
-            value = 1 << red_pin;
-        } else if (sample > threshold) {
-            value = 1 << green_pin;
-        }
-
-        out_b = value;
-
-        delay(250);
-        toggle_led();
+    exti_attach(0, button_reset, NULL);
+    exti_attach(1, button_swap, NULL);
+
+    // Binary telemetry and log messages on USART1 (PA9)
+    // Decode with tools/logdec
+    telemetry_init(115200);
+
+    // The control loop runs at 1 kHz, with the LED blinking out of phase
+    task_add(&control_task, control, NULL, 1000, 0, 500);
+    task_add(&blink_task, blink, NULL, 250000, 500, 0);
+    task_start();
+
+    coro_start(&coros[0], leds, NULL);
+    coro_start(&coros[1], report, NULL);
+    if (!warm) {
+        coro_start(&coros[2], bench, NULL);
     }
+
+    coro_loop();
 }
@@ -0,0 +1,38 @@
+#ifndef __STM32F103C8_PWR_H__
+#define __STM32F103C8_PWR_H__
+
+#include <stdint.h>
+
+
+/*
+ * Power control (PWR)
+ * Section 5.4 in STM32F103xx MCU reference manual.
+ */
+struct pwr
+{
+    uint32_t cr;        // Power control (bit 8 DBP: backup domain write access)
+    uint32_t csr;       // Power control/status
+};
+
+extern volatile struct pwr pwr;
+
+
+/*
+ * Backup registers (BKP)
+ * Section 6.4 in STM32F103xx MCU reference manual.
+ *
+ * The data registers keep their (16-bit) values across resets and in
+ * standby mode. They can only be written after setting DBP in PWR_CR.
+ */
+struct bkp
+{
+    uint32_t reserved;
+    uint32_t dr[10];    // Data registers 1-10
+    uint32_t rtccr;     // RTC clock calibration
+    uint32_t cr;        // Control register
+    uint32_t csr;       // Control/status register
+};
+
+extern volatile struct bkp bkp;
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include "reset.h"
+#include "clock.h"
+#include "clk.h"
+#include "sys.h"
+#include "pwr.h"
+#include "boot.h"
+
+#define RECORD_MAGIC    0x7761726d  // "warm"
+
+
+struct reset_record reset_record __attribute__((section(".noinit")));
+
+
+static uint32_t checksum(const struct reset_record* record)
+{
+    const uint32_t* words = (const uint32_t*) record;
+    uint32_t sum = 0;
+
+    // Rotate so that swapped words change the sum
+    for (uint32_t i = 0; i < sizeof(*record) / 4 - 1; ++i) {
+        sum = ((sum << 5) | (sum >> 27)) ^ words[i];
+    }
+
+    return ~sum;
+}
+
+
+int reset_init(void)
+{
+    uint32_t flags = rcc.csr & 0xfc000000;
+
+    // Clear the flags, so the next reset reports only its own cause
+    rcc.csr |= 1 << 24;
+
+    int warm = reset_record.magic == RECORD_MAGIC
+        && reset_record.checksum == checksum(&reset_record)
+        && !(flags & (RESET_POR | RESET_LPWR));
+
+    if (warm) {
+        ++reset_record.warm_boots;
+    } else {
+        uint32_t* words = (uint32_t*) &reset_record;
+        for (uint32_t i = 0; i < sizeof(reset_record) / 4; ++i) {
+            words[i] = 0;
+        }
+        reset_record.magic = RECORD_MAGIC;
+    }
+
+    reset_record.flags = flags;
+    reset_save();
+
+    return warm;
+}
+
+
+void reset_save(void)
+{
+    reset_record.checksum = checksum(&reset_record);
+}
+
+
+void reset_system(void)
+{
+    __asm__ volatile ("dsb" ::: "memory");
+    scb.aircr = (0x05fa << 16) | (scb.aircr & (7 << 8)) | (1 << 2);
+    __asm__ volatile ("dsb" ::: "memory");
+
+    while (1);
+}
+
+
+void reset_bootloader(void)
+{
+    // Write access to the backup domain
+    clk_get(CLK_PWR);
+    clk_get(CLK_BKP);
+    pwr.cr |= 1 << 8;
+
+    bkp.dr[0] = BOOT_REQUEST;
+
+    reset_system();
+}
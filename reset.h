@@ -0,0 +1,72 @@
+#ifndef __STM32F103C8_RESET_H__
+#define __STM32F103C8_RESET_H__
+
+#include <stdint.h>
+
+
+/*
+ * Reset flags in RCC_CSR.
+ * See section 7.3.10 in STM32F103xx MCU reference manual.
+ *
+ * The NRST pin is driven low by every internal reset source, so
+ * RESET_PIN is set along with the other flags.
+ */
+#define RESET_PIN       (1UL << 26) // NRST pin
+#define RESET_POR       (1UL << 27) // Power-on/power-down reset
+#define RESET_SOFT      (1UL << 28) // Software reset (SYSRESETREQ)
+#define RESET_IWDG      (1UL << 29) // Independent watchdog
+#define RESET_WWDG      (1UL << 30) // Window watchdog
+#define RESET_LPWR      (1UL << 31) // Low-power management reset
+
+
+/*
+ * State kept in RAM across resets.
+ *
+ * The record lives in the .noinit section, which the startup code does
+ * not touch, so it survives any reset that does not remove power. It is
+ * only trusted if its magic number and checksum are valid.
+ */
+struct reset_record
+{
+    uint32_t magic;
+    uint32_t flags;         // RCC_CSR reset flags of the last reset
+    uint32_t warm_boots;    // Warm boots since the last cold boot
+    uint32_t adc_cal;       // ADC calibration code
+    uint32_t data[4];       // Application state
+    uint32_t checksum;
+};
+
+extern struct reset_record reset_record;
+
+
+/*
+ * Read and clear the reset flags, and validate the reset record.
+ *
+ * Returns 1 on a warm boot, i.e., the record is valid and the reset was
+ * not caused by a power cycle. Otherwise, the record is cleared and 0
+ * is returned. Must be called once, early in main.
+ */
+int reset_init(void);
+
+
+/*
+ * Update the checksum after changing the record. The record may be
+ * changed from any context, but must be changed and saved with
+ * interrupts disabled.
+ */
+void reset_save(void);
+
+
+/*
+ * Request a system reset (warm boot).
+ * See section 4.4.4 in STM32F10xxx Cortex-M3 programming manual.
+ */
+void reset_system(void) __attribute__((noreturn));
+
+
+/*
+ * Reset into the bootloader, which waits for a new image (see boot.h).
+ */
+void reset_bootloader(void) __attribute__((noreturn));
+
+#endif
@@ -0,0 +1,262 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include "spi.h"
+#include "dma.h"
+#include "irq.h"
+#include "gpio.h"
+#include "clock.h"
+#include "clk.h"
+
+
+/*
+ * Per-SPI driver state.
+ */
+struct spi_bus
+{
+    volatile struct spi* spi;
+    enum clk clk;                   // SPI clock
+    enum clk port;                  // GPIO port clock
+    int rx_ch;                      // DMA1 channel for RX
+    int tx_ch;                      // DMA1 channel for TX
+    struct spi_xfer* head;          // Running transaction
+    struct spi_xfer* tail;          // Last queued transaction
+};
+
+
+static struct spi_bus buses[2] = {
+    { .spi = &spi1, .clk = CLK_SPI1, .port = CLK_GPIOA, .rx_ch = 2, .tx_ch = 3 },
+    { .spi = &spi2, .clk = CLK_SPI2, .port = CLK_GPIOB, .rx_ch = 4, .tx_ch = 5 },
+};
+
+
+/*
+ * Dummy source and sink for transactions without tx or rx buffer
+ */
+static const uint8_t dummy_tx = 0xff;
+static uint8_t dummy_rx;
+
+
+static struct spi_bus* get_bus(volatile struct spi* spi)
+{
+    if (spi == &spi1) {
+        return &buses[0];
+    } else if (spi == &spi2) {
+        return &buses[1];
+    }
+    return NULL;
+}
+
+
+/*
+ * Clocks are only held while there are transactions queued.
+ */
+static void power_up(struct spi_bus* bus)
+{
+    clk_get(CLK_DMA1);
+    clk_get(bus->port);
+    clk_get(bus->clk);
+}
+
+
+static void power_down(struct spi_bus* bus)
+{
+    clk_put(bus->clk);
+    clk_put(bus->port);
+    clk_put(CLK_DMA1);
+}
+
+
+/*
+ * Assert chip select and start DMA for the transaction at the head
+ * of the queue.
+ *
+ * The RX channel must be enabled before TX, otherwise the first received
+ * byte may overrun before the RX channel is ready.
+ * See section 25.3.9 in STM32F103xx MCU reference manual.
+ */
+static void start(struct spi_bus* bus)
+{
+    struct spi_xfer* xfer = bus->head;
+
+    if (xfer->cs_port != NULL) {
+        xfer->cs_port->brr = 1 << xfer->cs_pin;
+    }
+
+    if (xfer->rx != NULL) {
+        dma_start(&dma1, bus->rx_ch, &bus->spi->dr, xfer->rx, xfer->len,
+                DMA_MINC | DMA_TCIE | DMA_TEIE | DMA_PRIO_HIGH);
+    } else {
+        dma_start(&dma1, bus->rx_ch, &bus->spi->dr, &dummy_rx, xfer->len,
+                DMA_TCIE | DMA_TEIE | DMA_PRIO_HIGH);
+    }
+
+    if (xfer->tx != NULL) {
+        dma_start(&dma1, bus->tx_ch, &bus->spi->dr, xfer->tx, xfer->len,
+                DMA_MEM2PERIPH | DMA_MINC | DMA_TEIE | DMA_PRIO_MEDIUM);
+    } else {
+        dma_start(&dma1, bus->tx_ch, &bus->spi->dr, &dummy_tx, xfer->len,
+                DMA_MEM2PERIPH | DMA_TEIE | DMA_PRIO_MEDIUM);
+    }
+}
+
+
+/*
+ * RX and TX DMA interrupt handler.
+ *
+ * When the RX channel completes, the last byte has been clocked in and
+ * the transaction is done. A transfer error on either channel ends the
+ * transaction as well, with -EIO. The next queued transaction is started
+ * before the callback is invoked, so the bus does not idle while the
+ * callback runs.
+ */
+static void complete(void* arg)
+{
+    struct spi_bus* bus = arg;
+    struct spi_xfer* xfer = bus->head;
+    uint32_t rx_status = dma_status(&dma1, bus->rx_ch);
+    uint32_t status = rx_status | dma_status(&dma1, bus->tx_ch);
+
+    // The other channel's interrupt may still be pending after its flags
+    // were cleared here, it must not end the next transaction
+    if (!(rx_status & DMA_TCIF) && !(status & DMA_TEIF)) {
+        return;
+    }
+
+    dma_stop(&dma1, bus->rx_ch);
+    dma_stop(&dma1, bus->tx_ch);
+
+    if (xfer == NULL) {
+        return;
+    }
+
+    xfer->status = (status & DMA_TEIF) ? -EIO : 0;
+
+    if (xfer->cs_port != NULL) {
+        xfer->cs_port->bssr = 1 << xfer->cs_pin;
+    }
+
+    bus->head = xfer->next;
+    if (bus->head != NULL) {
+        start(bus);
+    } else {
+        bus->tail = NULL;
+        power_down(bus);
+    }
+
+    if (xfer->callback != NULL) {
+        xfer->callback(xfer, xfer->arg);
+    }
+}
+
+
+/*
+ * Initialize SPI in master mode.
+ * See section 25.3.3 in STM32F103xx MCU reference manual.
+ */
+int spi_init(volatile struct spi* spi, uint32_t freq, enum spi_mode mode)
+{
+    struct spi_bus* bus = get_bus(spi);
+    int pclk;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    // The DMA channels are shared with other peripherals (see spi.h)
+    int rx_irq = IRQ_DMA1_Channel1 + bus->rx_ch - 1;
+    int tx_irq = IRQ_DMA1_Channel1 + bus->tx_ch - 1;
+    if (irq_taken(rx_irq, complete, bus) || irq_taken(tx_irq, complete, bus)) {
+        return -EBUSY;
+    }
+
+    clk_get(bus->port);
+    clk_get(bus->clk);
+
+    if (spi == &spi1) {
+        pclk = rcc_pclk2();
+
+        gpio_cfg(&gpioa, 5, GPIO_AFIO_PUSHPULL, GPIO_50MHZ);  // SCK
+        gpio_cfg(&gpioa, 6, GPIO_HIGHIMP, GPIO_INPUT);        // MISO
+        gpio_cfg(&gpioa, 7, GPIO_AFIO_PUSHPULL, GPIO_50MHZ);  // MOSI
+    } else {
+        pclk = rcc_pclk1();
+
+        gpio_cfg(&gpiob, 13, GPIO_AFIO_PUSHPULL, GPIO_50MHZ); // SCK
+        gpio_cfg(&gpiob, 14, GPIO_HIGHIMP, GPIO_INPUT);       // MISO
+        gpio_cfg(&gpiob, 15, GPIO_AFIO_PUSHPULL, GPIO_50MHZ); // MOSI
+    }
+
+    irq_attach(rx_irq, complete, bus);
+    irq_attach(tx_irq, complete, bus);
+
+    // Find smallest baud rate prescaler (PCLK/2 - PCLK/256)
+    int br = 0;
+    while (br < 7 && (uint32_t) (pclk >> (br + 1)) > freq) {
+        ++br;
+    }
+
+    // Master mode, software slave management (NSS internally high)
+    spi->cr1 = 0;
+    spi->cr1 = (1 << 9) | (1 << 8) | (br << 3) | (1 << 2) | (mode & 3);
+
+    // Let DMA handle RXNE and TXE
+    spi->cr2 = (1 << 1) | 1;
+
+    // Enable SPI
+    spi->cr1 |= 1 << 6;
+
+    clk_put(bus->clk);
+    clk_put(bus->port);
+
+    bus->head = NULL;
+    bus->tail = NULL;
+
+    irq_enable(rx_irq);
+    irq_enable(tx_irq);
+
+    return pclk >> (br + 1);
+}
+
+
+int spi_cs_init(volatile struct gpio* port, int pin)
+{
+    port->bssr = 1 << pin;
+    return gpio_cfg(port, pin, GPIO_PUSHPULL, GPIO_50MHZ);
+}
+
+
+int spi_submit(volatile struct spi* spi, struct spi_xfer* xfer)
+{
+    struct spi_bus* bus = get_bus(spi);
+
+#ifndef NDEBUG
+    if (bus == NULL || xfer == NULL || xfer->len == 0) {
+        return -EINVAL;
+    }
+#endif
+
+    xfer->next = NULL;
+    xfer->status = -EINPROGRESS;
+
+    uint32_t primask = irq_save();
+    if (bus->tail != NULL) {
+        bus->tail->next = xfer;
+        bus->tail = xfer;
+    } else {
+        power_up(bus);
+        bus->head = xfer;
+        bus->tail = xfer;
+        start(bus);
+    }
+    irq_restore(primask);
+
+    return 0;
+}
+
+
+int spi_busy(volatile struct spi* spi)
+{
+    struct spi_bus* bus = get_bus(spi);
+    return bus != NULL && bus->head != NULL;
+}
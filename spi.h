@@ -0,0 +1,109 @@
+#ifndef __STM32F103C8_SPI_H__
+#define __STM32F103C8_SPI_H__
+
+#include <stdint.h>
+#include "gpio.h"
+
+
+/*
+ * Serial peripheral interface (SPI)
+ * Section 25 in STM32F103xx MCU reference manual.
+ */
+struct spi
+{
+    uint32_t cr1;       // Control register 1
+    uint32_t cr2;       // Control register 2
+    uint32_t sr;        // Status register
+    uint32_t dr;        // Data register
+    uint32_t crcpr;     // CRC polynomial
+    uint32_t rxcrcr;    // RX CRC register
+    uint32_t txcrcr;    // TX CRC register
+    uint32_t i2scfgr;   // I2S configuration
+    uint32_t i2spr;     // I2S prescaler
+};
+
+
+/*
+ * Available SPIs
+ */
+extern volatile struct spi spi1;
+extern volatile struct spi spi2;
+
+
+/*
+ * SPI clock polarity and phase.
+ * See section 25.3.1 in the STM32F103xx MCU reference manual.
+ */
+enum spi_mode
+{
+    SPI_MODE0   = 0,    // CPOL=0, CPHA=0
+    SPI_MODE1   = 1,    // CPOL=0, CPHA=1
+    SPI_MODE2   = 2,    // CPOL=1, CPHA=0
+    SPI_MODE3   = 3,    // CPOL=1, CPHA=1
+};
+
+
+/*
+ * SPI transaction.
+ *
+ * A transaction clocks out len bytes from tx while clocking in len bytes
+ * to rx. If tx is NULL, 0xff is sent. If rx is NULL, received data is
+ * discarded. If cs_port is set, the chip select pin is driven low for the
+ * duration of the transaction.
+ *
+ * The structure is owned by the driver from spi_submit() until the callback
+ * is invoked (from interrupt context), so it must not live on the stack of
+ * a function that returns before that. status is 0 on success and -EIO if
+ * the DMA reported a transfer error.
+ */
+struct spi_xfer
+{
+    const void* tx;                 // Data to send (or NULL)
+    void* rx;                       // Receive buffer (or NULL)
+    uint16_t len;                   // Number of bytes
+    volatile struct gpio* cs_port;  // Chip select port (or NULL)
+    int cs_pin;                     // Chip select pin
+    void (*callback)(struct spi_xfer* xfer, void* arg);
+    void* arg;                      // Callback argument
+    int status;                     // Completion status
+    struct spi_xfer* next;          // Used by the driver
+};
+
+
+/*
+ * Initialize SPI as master, using full-duplex DMA transfers.
+ * SPI1 uses DMA1 channel 2 (RX) and 3 (TX), on pins PA5-PA7.
+ * SPI2 uses DMA1 channel 4 (RX) and 5 (TX), on pins PB13-PB15, which means
+ * it can not be used together with telemetry (see telemetry.h) or I2C2.
+ *
+ * The SPI clock is the highest PCLK/2^n that does not exceed freq.
+ * Returns the resulting SPI clock on success, -EBUSY if another driver
+ * has taken the DMA channel interrupts, and -ERRNO on other failures.
+ */
+int spi_init(volatile struct spi* spi, uint32_t freq, enum spi_mode mode);
+
+
+/*
+ * Configure a GPIO pin as chip select output (deasserted/high).
+ */
+int spi_cs_init(volatile struct gpio* port, int pin);
+
+
+/*
+ * Queue a transaction.
+ *
+ * Transactions are started in order from the DMA completion interrupt of
+ * the previous one, so the bus is kept busy as long as the queue is not
+ * empty. May be called from interrupt context, including from a callback.
+ *
+ * Returns 0 on success, and -ERRNO on failure.
+ */
+int spi_submit(volatile struct spi* spi, struct spi_xfer* xfer);
+
+
+/*
+ * Returns non-zero if there are queued or running transactions.
+ */
+int spi_busy(volatile struct spi* spi);
+
+#endif
@@ -12,11 +12,11 @@ struct scb
 {
     const uint32_t cpuid;   // CPUID base register
     uint32_t icsr;          // Interrupt control and state 
-    const uint32_t vtor;    // Vector table offset
+    uint32_t vtor;          // Vector table offset
     uint32_t aircr;         // Application interrupt and reset control
     uint32_t scr;           // System control register
     uint32_t ccr;           // Configuration and control register
-    uint32_t shpr[3];       // System handler priority 
+    uint8_t shpr[12];       // System handler priority (exception 4-15)
     uint32_t shcsr;         // System handler control and state
     uint32_t cfsr;          // Configurable fault status
     uint32_t hfsr;          // Hard fault status
@@ -44,4 +44,38 @@ extern volatile struct stk systick;
 
 
 
+/*
+ * Data watchpoint and trace unit (DWT)
+ * Section 11.5 in ARMv7-M Architecture Reference Manual.
+ *
+ * Only the cycle counter is used. The startup code enables and clears it,
+ * so CYCCNT counts core clock cycles since reset.
+ */
+struct dwt
+{
+    uint32_t ctrl;          // Control register
+    uint32_t cyccnt;        // Cycle count
+    uint32_t cpicnt;        // CPI count
+    uint32_t exccnt;        // Exception overhead count
+    uint32_t sleepcnt;      // Sleep count
+    uint32_t lsucnt;        // LSU count
+    uint32_t foldcnt;       // Folded-instruction count
+    const uint32_t pcsr;    // Program counter sample
+};
+
+extern volatile struct dwt dwt;
+
+
+
+/*
+ * Bit-band alias of a single bit in a peripheral register
+ * (0x40000000-0x400fffff). Writing 0 or 1 to the alias clears or sets
+ * the bit in one bus write, so no read-modify-write is needed.
+ * See section 2.2.5 in STM32F10xxx Cortex-M3 programming manual.
+ */
+#define BITBAND_PERIPH(reg, bit) \
+    (*(volatile uint32_t*) (0x42000000 + (((uint32_t) &(reg) - 0x40000000) * 32) + ((bit) * 4)))
+
+
+
 #endif
@@ -0,0 +1,257 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include "task.h"
+#include "timer.h"
+#include "clock.h"
+#include "clk.h"
+#include "irq.h"
+#include "sys.h"
+
+#define TIMEBASE_FREQ   1000000     // TIM2 tick rate (Hz)
+
+
+/*
+ * Tasks sorted by period (rate-monotonic priority), so that bit i of
+ * pending is tasks[i], which runs from lines[i] at priority
+ * TASK_PRIORITY + i
+ */
+static struct task* tasks[TASK_MAX];
+static int num_tasks;
+static int started;
+
+
+static volatile uint32_t pending;   // Released, not completed
+
+
+/*
+ * Interrupt lines of peripherals that are not used, pended in software
+ * to run the tasks
+ */
+static const uint8_t lines[TASK_MAX] = {
+    IRQ_USB_HP_CAN_TX, IRQ_USB_LP_CAN_RX0, IRQ_CAN_RX1, IRQ_CAN_SCE,
+    IRQ_TIM1_BRK, IRQ_TIM1_UP, IRQ_TIM1_TRG_COM, IRQ_TIM1_CC
+};
+
+
+/*
+ * TIM2 overflows, the upper half of the time
+ */
+static volatile uint32_t overflows;
+
+
+int task_add(struct task* t, void (*fn)(void* arg), void* arg,
+             uint32_t period, uint32_t offset, uint32_t deadline)
+{
+#ifndef NDEBUG
+    if (t == NULL || fn == NULL || period == 0 || (int32_t) period < 0
+            || (int32_t) offset < 0 || deadline > period) {
+        return -EINVAL;
+    }
+#endif
+
+    if (started) {
+        return -EBUSY;
+    }
+
+    if (num_tasks == TASK_MAX) {
+        return -ENOSPC;
+    }
+
+    t->fn = fn;
+    t->arg = arg;
+    t->period = period;
+    t->deadline = deadline != 0 ? deadline : period;
+    t->release = offset;
+    t->exec_avg16 = 0;
+    t->stats = (struct task_stats) { 0 };
+
+    // Tasks with the same period keep the order they were added in
+    int i = num_tasks++;
+    while (i > 0 && tasks[i - 1]->period > period) {
+        tasks[i] = tasks[i - 1];
+        --i;
+    }
+    tasks[i] = t;
+
+    return 0;
+}
+
+
+uint32_t task_now(void)
+{
+    uint32_t primask = irq_save();
+    uint32_t high = overflows;
+    uint16_t low = tim2.cnt;
+
+    // The counter has wrapped, but the interrupt has not been handled yet
+    if ((tim2.sr & 1) && low < 0x8000) {
+        ++high;
+    }
+    irq_restore(primask);
+
+    return (high << 16) | low;
+}
+
+
+/*
+ * Release the tasks that are due and program CC1 for the next release.
+ * Must be called with interrupts disabled.
+ */
+static void release(void)
+{
+    uint32_t now = task_now();
+    uint32_t next = 0;
+    int32_t min = INT32_MAX;
+
+    for (int i = 0; i < num_tasks; ++i) {
+        struct task* t = tasks[i];
+
+        if ((int32_t) (now - t->release) >= 0) {
+            if (pending & (1 << i)) {
+                ++t->stats.skipped;
+            } else {
+                t->released = t->release;
+                pending |= 1 << i;
+                nvic.ispr[lines[i] / 32] = 1 << (lines[i] % 32);
+            }
+
+            // Releases missed entirely (e.g., halted by a debugger)
+            // are skipped as well, keeping the phase
+            t->release += t->period;
+            while ((int32_t) (now - t->release) >= 0) {
+                t->release += t->period;
+                ++t->stats.skipped;
+            }
+        }
+
+        int32_t left = t->release - now;
+        if (left < min) {
+            min = left;
+            next = t->release;
+        }
+    }
+
+    // Releases more than one counter period away are reconsidered
+    // at the overflow interrupt
+    if (min <= 0xffff) {
+        tim2.ccr[0] = next & 0xffff;
+        tim2.sr = ~(1 << 1);
+        tim2.dier |= 1 << 1;
+
+        // The release time may have passed while we were busy,
+        // in which case the compare would not match until the counter wraps
+        if ((int32_t) (next - task_now()) <= 0) {
+            tim2.egr = 1 << 1;
+        }
+    } else {
+        tim2.dier &= ~(1 << 1);
+    }
+}
+
+
+/*
+ * TIM2 interrupt handler.
+ */
+static void timer_handler(void* arg)
+{
+    (void) arg;
+
+    uint32_t primask = irq_save();
+    uint32_t sr = tim2.sr;
+
+    if (sr & 1) {
+        tim2.sr = ~1;
+        overflows = overflows + 1;
+    }
+    tim2.sr = ~(1 << 1);
+
+    release();
+    irq_restore(primask);
+}
+
+
+/*
+ * Task interrupt handler: run the released job of task arg. Preempted by
+ * the tasks with a shorter period, which run from higher priority lines.
+ */
+static void dispatch(void* arg)
+{
+    int i = (uintptr_t) arg;
+    struct task* t = tasks[i];
+    uint32_t start = task_now();
+
+    t->fn(t->arg);
+
+    uint32_t end = task_now();
+    uint32_t exec = end - start;
+    uint32_t jitter = start - t->released;
+
+    uint32_t primask = irq_save();
+    pending &= ~(1 << i);
+
+    // Moving average with weight 1/16, kept with 4 fractional bits
+    if (t->stats.runs++ == 0) {
+        t->exec_avg16 = exec << 4;
+    } else {
+        t->exec_avg16 += exec - (t->exec_avg16 >> 4);
+    }
+    if (exec > t->stats.exec_max) {
+        t->stats.exec_max = exec;
+    }
+    if (jitter > t->stats.jitter_max) {
+        t->stats.jitter_max = jitter;
+    }
+    if (end - t->released > t->deadline) {
+        ++t->stats.misses;
+    }
+    irq_restore(primask);
+}
+
+
+/*
+ * Set up TIM2 as a free-running 16-bit counter at TIMEBASE_FREQ, extended
+ * to 32 bits by counting overflows, using compare channel 1 for releases.
+ * See section 15.3 in STM32F103xx MCU reference manual.
+ */
+void task_start(void)
+{
+    clk_get(CLK_TIM2);
+
+    tim2.cr1 = 0;
+    tim2.psc = rcc_timclk1() / TIMEBASE_FREQ - 1;
+    tim2.arr = 0xffff;
+    tim2.cnt = 0;
+
+    // Load prescaler, then clear the update flag this causes
+    tim2.egr = 1;
+    tim2.sr = 0;
+    tim2.dier = 1;
+
+    // Shortest period first, set directly as the priorities are the
+    // same regardless of grouping (see irq_set_priority())
+    for (int i = 0; i < num_tasks; ++i) {
+        nvic.ipr[lines[i]] = (TASK_PRIORITY + i) << 4;
+        irq_attach(lines[i], dispatch, (void*) (uintptr_t) i);
+        irq_enable(lines[i]);
+    }
+
+    irq_attach(IRQ_TIM2, timer_handler, NULL);
+
+    uint32_t primask = irq_save();
+    started = 1;
+    overflows = 0;
+    tim2.cr1 = 1;
+    irq_enable(IRQ_TIM2);
+    release();
+    irq_restore(primask);
+}
+
+
+void task_stats(const struct task* t, struct task_stats* stats)
+{
+    uint32_t primask = irq_save();
+    *stats = t->stats;
+    stats->exec_avg = t->exec_avg16 >> 4;
+    irq_restore(primask);
+}
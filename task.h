@@ -0,0 +1,93 @@
+#ifndef __STM32F103C8_TASK_H__
+#define __STM32F103C8_TASK_H__
+
+#include <stdint.h>
+
+
+/*
+ * Periodic tasks.
+ *
+ * Tasks are released from TIM2, which counts microseconds. Every task has
+ * an absolute release time that is advanced by exactly one period at each
+ * release, so the period does not drift with how long the task or the
+ * interrupts before it took.
+ *
+ * Tasks are scheduled rate-monotonic: every task runs from its own
+ * interrupt, pended in software, at a priority given by its period, so a
+ * task with a shorter period preempts one with a longer period. The
+ * interrupt lines are those of USB/CAN and, beyond four tasks, of TIM1,
+ * which can then not be used otherwise (see task.c).
+ *
+ * Tasks run at priorities TASK_PRIORITY (shortest period) to
+ * TASK_PRIORITY + TASK_MAX - 1, so they preempt coroutines (see coro.h)
+ * and interrupts with a lower priority, but not those with a higher
+ * priority. With fewer than four preemption bits (see irq_set_grouping()),
+ * some tasks share a preemption level and run to completion in turn.
+ *
+ * A task that is released again before its previous job has finished
+ * skips that release.
+ */
+#define TASK_MAX        8
+#define TASK_PRIORITY   8
+
+
+/*
+ * Statistics, all times in microseconds.
+ */
+struct task_stats
+{
+    uint32_t runs;          // Jobs completed
+    uint32_t exec_max;      // Execution time, including preemption
+    uint32_t exec_avg;      // Moving average over about 16 jobs
+    uint32_t jitter_max;    // Time from release to start
+    uint32_t misses;        // Jobs completed after their deadline
+    uint32_t skipped;       // Releases skipped as the job was still running
+};
+
+
+struct task
+{
+    void (*fn)(void* arg);
+    void* arg;
+    uint32_t period;
+    uint32_t deadline;      // Relative to release
+    uint32_t release;       // Next release time
+    uint32_t released;      // Release time of the current job
+    uint32_t exec_avg16;    // Execution time average times 16
+    struct task_stats stats;
+};
+
+
+/*
+ * Add a task, run as fn(arg) every period microseconds. The first release
+ * is offset microseconds after task_start(). The deadline is relative to
+ * the release, 0 meaning the end of the period.
+ *
+ * Tasks must be added before task_start(). Returns 0 on success, -EINVAL
+ * on invalid arguments, -ENOSPC if there are TASK_MAX tasks already and
+ * -EBUSY if the tasks have been started.
+ */
+int task_add(struct task* t, void (*fn)(void* arg), void* arg,
+             uint32_t period, uint32_t offset, uint32_t deadline);
+
+
+/*
+ * Start the timebase and release tasks. The TIM2 interrupt priority
+ * decides how precisely tasks are released.
+ */
+void task_start(void);
+
+
+/*
+ * Current time in microseconds since task_start().
+ * Wraps around after 71 minutes, compare times by their difference.
+ */
+uint32_t task_now(void);
+
+
+/*
+ * Get a consistent copy of the statistics of a task.
+ */
+void task_stats(const struct task* t, struct task_stats* stats);
+
+#endif
@@ -0,0 +1,370 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include "telemetry.h"
+#include "usart.h"
+#include "dma.h"
+#include "irq.h"
+#include "gpio.h"
+#include "clock.h"
+#include "clk.h"
+
+#define TX_CHANNEL  4   // DMA1 channel for USART1_TX
+
+
+/*
+ * CRC-16/CCITT-FALSE lookup table (poly 0x1021)
+ */
+static const uint16_t crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
+};
+
+
+/*
+ * Transmitter state.
+ *
+ * A frame is three segments (header, payload, CRC) which are COBS
+ * encoded as if they were one buffer. The cursor points to the next
+ * byte to be sent.
+ */
+static struct
+{
+    struct telemetry_frame* head;   // Frame being sent
+    struct telemetry_frame* tail;   // Last queued frame
+    uint16_t seq;                   // Next sequence number
+    const uint8_t* seg[3];          // Frame segments
+    uint16_t seg_len[3];
+    int idx;                        // Cursor segment
+    uint16_t off;                   // Cursor offset in segment
+    uint16_t crc;                   // Running CRC of scanned bytes
+    uint8_t code;                   // COBS code byte of current block
+    uint8_t run;                    // Bytes of current block left to send
+    uint8_t skip;                   // Current block ends with a zero
+    uint8_t last;                   // Current block is the last one
+    uint8_t done;                   // Delimiter has been sent
+    uint8_t powered;                // Holding the USART1 clock
+} tx;
+
+
+static const uint8_t delimiter = 0;
+
+
+/*
+ * Start a DMA transfer to the USART. TC is cleared first, so that it is
+ * only set once the last transfer of a burst has been shifted out, even
+ * if the completion interrupt of a transfer is served late.
+ * See section 27.3.13 in the reference manual.
+ */
+static void send(const void* ptr, uint16_t len)
+{
+    usart1.sr = ~(1 << 6);
+    dma_start(&dma1, TX_CHANNEL, &usart1.dr, ptr, len,
+            DMA_MEM2PERIPH | DMA_MINC | DMA_TCIE | DMA_TEIE);
+}
+
+
+/*
+ * Move cursor past empty or exhausted segments.
+ */
+static void normalize(void)
+{
+    while (tx.idx < 3 && tx.off == tx.seg_len[tx.idx]) {
+        ++tx.idx;
+        tx.off = 0;
+    }
+}
+
+
+/*
+ * Scan the next COBS block starting at the cursor.
+ *
+ * Counts up to 254 non-zero bytes, updating the CRC for every byte
+ * scanned (including the terminating zero). Since blocks are scanned in
+ * order, the CRC is complete once the scan reaches the CRC segment.
+ */
+static void scan(void)
+{
+    int idx = tx.idx;
+    uint16_t off = tx.off;
+    uint8_t n = 0;
+
+    tx.skip = 0;
+    tx.last = 0;
+
+    while (n < 254) {
+        while (idx < 3 && off == tx.seg_len[idx]) {
+            if (++idx == 2) {
+                tx.head->crc[0] = tx.crc & 0xff;
+                tx.head->crc[1] = tx.crc >> 8;
+            }
+            off = 0;
+        }
+
+        if (idx == 3) {
+            tx.last = 1;
+            break;
+        }
+
+        uint8_t byte = tx.seg[idx][off];
+        if (idx < 2) {
+            tx.crc = (tx.crc << 8) ^ crc16_table[((tx.crc >> 8) ^ byte) & 0xff];
+        }
+
+        if (byte == 0) {
+            tx.skip = 1;
+            break;
+        }
+
+        ++n;
+        ++off;
+    }
+
+    tx.run = n;
+    tx.code = n + 1;
+}
+
+
+/*
+ * Set up encoder for the frame at the head of the queue.
+ */
+static void load(void)
+{
+    struct telemetry_frame* frame = tx.head;
+
+    tx.seg[0] = frame->header;
+    tx.seg_len[0] = sizeof(frame->header);
+    tx.seg[1] = frame->data;
+    tx.seg_len[1] = frame->len;
+    tx.seg[2] = frame->crc;
+    tx.seg_len[2] = sizeof(frame->crc);
+    tx.idx = 0;
+    tx.off = 0;
+    tx.crc = 0xffff;
+    tx.run = 0;
+    tx.skip = 0;
+    tx.last = 0;
+    tx.done = 0;
+}
+
+
+/*
+ * Start the next DMA transfer of the current frame.
+ *
+ * Each block is sent as its code byte followed by one transfer per
+ * segment the run of non-zero bytes spans. Returns 0 when the frame
+ * has been completely sent.
+ */
+static int advance(void)
+{
+    if (tx.run > 0) {
+        normalize();
+
+        uint16_t len = tx.seg_len[tx.idx] - tx.off;
+        if (len > tx.run) {
+            len = tx.run;
+        }
+
+        send(tx.seg[tx.idx] + tx.off, len);
+        tx.off += len;
+        tx.run -= len;
+        return 1;
+    }
+
+    if (tx.last) {
+        if (tx.done) {
+            return 0;
+        }
+
+        tx.done = 1;
+        send(&delimiter, 1);
+        return 1;
+    }
+
+    if (tx.skip) {
+        normalize();
+        ++tx.off;
+    }
+
+    scan();
+    send(&tx.code, 1);
+    return 1;
+}
+
+
+/*
+ * DMA transfer complete interrupt handler.
+ */
+static void dma_handler(void* arg)
+{
+    (void) arg;
+
+    dma_clear(&dma1, TX_CHANNEL);
+
+    if (tx.head == NULL || advance()) {
+        return;
+    }
+
+    // Frame is sent, start the next one before invoking the callback
+    struct telemetry_frame* frame = tx.head;
+
+    tx.head = frame->next;
+    if (tx.head != NULL) {
+        load();
+        advance();
+    } else {
+        tx.tail = NULL;
+        dma_stop(&dma1, TX_CHANNEL);
+        clk_put(CLK_DMA1);
+
+        // The last byte may still be shifted out, keep the USART clock
+        // until transmission complete. TC was cleared when the last
+        // transfer started, so if it is already set again, the interrupt
+        // is taken right away.
+        usart1.cr1 |= 1 << 6;
+    }
+
+    if (frame->callback != NULL) {
+        frame->callback(frame, frame->arg);
+    }
+}
+
+
+/*
+ * USART1 transmission complete interrupt handler.
+ */
+static void usart_handler(void* arg)
+{
+    (void) arg;
+
+    // telemetry_send() may be called from a higher priority interrupt
+    uint32_t primask = irq_save();
+    usart1.cr1 &= ~(1 << 6);
+
+    // Unless another frame has been queued in the meantime
+    if (tx.head == NULL && tx.powered) {
+        tx.powered = 0;
+        clk_put(CLK_USART1);
+    }
+    irq_restore(primask);
+}
+
+
+/*
+ * Initialize USART1 transmitter.
+ * See section 27.3.2 and 27.3.4 in the STM32F103xx MCU reference manual.
+ */
+int telemetry_init(uint32_t baud)
+{
+    uint32_t pclk = rcc_pclk2();
+
+    // Oversampling by 16, so USARTDIV must be at least 1
+    if (baud == 0 || baud > pclk / 16) {
+        return -EINVAL;
+    }
+
+    // The USART and DMA1 clocks are only held while frames are sent
+    clk_get(CLK_GPIOA);
+    clk_get(CLK_USART1);
+
+    gpio_cfg(&gpioa, 9, GPIO_AFIO_PUSHPULL, GPIO_50MHZ);
+    clk_put(CLK_GPIOA);
+
+    // BRR holds USARTDIV as 12.4 fixed point, which is simply
+    // PCLK / baud rounded to nearest
+    uint32_t brr = (pclk + baud / 2) / baud;
+
+    usart1.cr1 = 0;
+    usart1.brr = brr;
+    usart1.cr2 = 0;             // 1 stop bit
+    usart1.cr3 = 1 << 7;        // DMA transmitter
+    usart1.cr1 = (1 << 13) | (1 << 3); // USART and transmitter enable
+    clk_put(CLK_USART1);
+
+    tx.head = NULL;
+    tx.tail = NULL;
+    tx.powered = 0;
+
+    irq_attach(IRQ_DMA1_Channel4, dma_handler, NULL);
+    irq_enable(IRQ_DMA1_Channel4);
+    irq_attach(IRQ_USART1, usart_handler, NULL);
+    irq_enable(IRQ_USART1);
+
+    return pclk / brr;
+}
+
+
+int telemetry_send(struct telemetry_frame* frame)
+{
+#ifndef NDEBUG
+    if (frame == NULL || (frame->data == NULL && frame->len > 0)) {
+        return -EINVAL;
+    }
+#endif
+
+    frame->next = NULL;
+    frame->header[2] = frame->type;
+
+    uint32_t primask = irq_save();
+    frame->header[0] = tx.seq & 0xff;
+    frame->header[1] = tx.seq >> 8;
+    ++tx.seq;
+
+    if (tx.tail != NULL) {
+        tx.tail->next = frame;
+        tx.tail = frame;
+    } else {
+        clk_get(CLK_DMA1);
+        if (!tx.powered) {
+            clk_get(CLK_USART1);
+            tx.powered = 1;
+        }
+
+        // Not until the last byte of this burst
+        usart1.cr1 &= ~(1 << 6);
+
+        tx.head = frame;
+        tx.tail = frame;
+        load();
+        advance();
+    }
+    irq_restore(primask);
+
+    return 0;
+}
+
+
+int telemetry_busy(void)
+{
+    return tx.head != NULL;
+}
@@ -0,0 +1,78 @@
+#ifndef __STM32F103C8_TELEMETRY_H__
+#define __STM32F103C8_TELEMETRY_H__
+
+#include <stdint.h>
+
+
+/*
+ * Binary telemetry over USART1.
+ *
+ * Every frame is laid out as
+ *
+ *   seq (2, LE) | type (1) | payload (len) | CRC-16 (2, LE)
+ *
+ * where the CRC is CRC-16/CCITT-FALSE (poly 0x1021, init 0xffff) over
+ * everything preceding it. The frame is COBS encoded and terminated by
+ * a zero byte, so a receiver can resynchronize on any zero.
+ *
+ * Encoding is done on the fly while transmitting: COBS code bytes are
+ * computed by the DMA interrupt and runs of non-zero bytes are DMA'd
+ * straight out of the caller's buffer, so payloads are never copied.
+ */
+enum telemetry_type
+{
+    TELEMETRY_TEXT      = 0x01, // Human-readable text
+    TELEMETRY_COUNTERS  = 0x02, // Array of uint32_t counters
+    TELEMETRY_SAMPLES   = 0x03, // Array of uint16_t ADC samples
+    TELEMETRY_LOG       = 0x04, // Binary log messages (see log.h)
+};
+
+
+/*
+ * Telemetry frame.
+ *
+ * The structure and the payload it points to are owned by the driver from
+ * telemetry_send() until the callback is invoked (from interrupt context).
+ */
+struct telemetry_frame
+{
+    uint8_t type;                   // Frame type
+    const void* data;               // Payload
+    uint16_t len;                   // Payload length in bytes
+    void (*callback)(struct telemetry_frame* frame, void* arg);
+    void* arg;                      // Callback argument
+    uint8_t header[3];              // Used by the driver
+    uint8_t crc[2];
+    struct telemetry_frame* next;
+};
+
+
+/*
+ * Initialize USART1 for telemetry (8N1, TX only on PA9) using DMA1
+ * channel 4, which means it can not be used together with SPI2 or I2C2.
+ *
+ * The baud rate register is derived from the current PCLK2, so this must
+ * be called after rcc_sysclk(). Baud rates up to PCLK2/16 (4.5 Mbit/s at
+ * 72 MHz) are supported.
+ *
+ * Returns the actual baud rate on success, and -ERRNO on failure.
+ */
+int telemetry_init(uint32_t baud);
+
+
+/*
+ * Queue a frame for transmission. Frames are sent in order, and the
+ * sequence number is incremented for every frame.
+ *
+ * May be called from interrupt context. Returns 0 on success,
+ * and -ERRNO on failure.
+ */
+int telemetry_send(struct telemetry_frame* frame);
+
+
+/*
+ * Returns non-zero if there are frames queued or being transmitted.
+ */
+int telemetry_busy(void);
+
+#endif
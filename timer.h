@@ -0,0 +1,44 @@
+#ifndef __STM32F103C8_TIMER_H__
+#define __STM32F103C8_TIMER_H__
+
+#include <stdint.h>
+
+
+/*
+ * Advanced-control (TIM1) and general-purpose (TIM2-TIM4) timers.
+ * Section 14 and 15 in STM32F103xx MCU reference manual.
+ *
+ * The general-purpose timers have the same layout, except that RCR and
+ * BDTR are reserved.
+ */
+struct tim
+{
+    uint32_t cr1;       // Control register 1
+    uint32_t cr2;       // Control register 2
+    uint32_t smcr;      // Slave mode control
+    uint32_t dier;      // DMA/interrupt enable
+    uint32_t sr;        // Status register
+    uint32_t egr;       // Event generation
+    uint32_t ccmr1;     // Capture/compare mode 1
+    uint32_t ccmr2;     // Capture/compare mode 2
+    uint32_t ccer;      // Capture/compare enable
+    uint32_t cnt;       // Counter
+    uint32_t psc;       // Prescaler
+    uint32_t arr;       // Auto-reload
+    uint32_t rcr;       // Repetition counter (TIM1 only)
+    uint32_t ccr[4];    // Capture/compare 1-4
+    uint32_t bdtr;      // Break and dead-time (TIM1 only)
+    uint32_t dcr;       // DMA control
+    uint32_t dmar;      // DMA address for full transfer
+};
+
+
+/*
+ * Available timers
+ */
+extern volatile struct tim tim1;
+extern volatile struct tim tim2;
+extern volatile struct tim tim3;
+extern volatile struct tim tim4;
+
+#endif
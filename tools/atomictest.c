@@ -0,0 +1,289 @@
+/*
+ * Stress test of the lock-free primitives in atomic.h.
+ *
+ * Threads stand in for ISRs and thread code, with LDREX/STREX emulated
+ * by the __atomic builtins (see atomic.h). Threads yield regularly inside
+ * the operations, so that they interleave even on a single core. Small
+ * queues are used, so the full and empty cases are hit all the time.
+ *
+ * Usage: atomictest [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define PRODUCERS   4
+
+
+/*
+ * Yield at random in one of eight calls, from within LDREX/STREX
+ * sequences as well
+ */
+static void preempt(void)
+{
+    static _Thread_local uint32_t state = 1;
+
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    if ((state & 7) == 0) {
+        sched_yield();
+    }
+}
+
+#define ATOMIC_PREEMPT()    preempt()
+#include "../atomic.h"
+
+
+static uint32_t iterations = 200000;
+static int failed;
+
+
+/*
+ * atomic_add() from all threads, and atomic_xchg() passing a token that
+ * protects a plain counter
+ */
+static volatile uint32_t counter;
+static volatile uint32_t token = 1;
+static volatile uint32_t tokens;
+static volatile uint32_t taken;
+
+
+static void* counting(void* arg)
+{
+    uint32_t n = 0;
+
+    (void) arg;
+
+    for (uint32_t i = 0; i < iterations; ++i) {
+        atomic_add(&counter, 1);
+
+        if (atomic_xchg(&token, 0) == 1) {
+            tokens = tokens + 1;
+            ++n;
+            atomic_xchg(&token, 1);
+        }
+    }
+
+    atomic_add(&taken, n);
+    return NULL;
+}
+
+
+static void test_counter(void)
+{
+    pthread_t threads[PRODUCERS];
+
+    for (int i = 0; i < PRODUCERS; ++i) {
+        pthread_create(&threads[i], NULL, counting, NULL);
+    }
+    for (int i = 0; i < PRODUCERS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (counter != PRODUCERS * iterations) {
+        fprintf(stderr, "atomic_add: %u, expected %u\n", counter, PRODUCERS * iterations);
+        failed = 1;
+    }
+
+    if (tokens != taken || token != 1) {
+        fprintf(stderr, "atomic_xchg: counted %u, expected %u\n", tokens, taken);
+        failed = 1;
+    }
+
+    fprintf(stderr, "atomic_add/xchg: %u adds, token taken %u times\n", counter, tokens);
+}
+
+
+static struct spsc spsc;
+static uint32_t spsc_buf[16];
+static uint32_t spsc_full;
+
+
+static void* spsc_producer(void* arg)
+{
+    (void) arg;
+
+    for (uint32_t i = 0; i < iterations; ++i) {
+        while (spsc_push(&spsc, i) != 0) {
+            ++spsc_full;
+            sched_yield();
+        }
+        preempt();
+    }
+
+    return NULL;
+}
+
+
+static void test_spsc(void)
+{
+    pthread_t thread;
+    uint32_t value;
+
+    spsc_init(&spsc, spsc_buf, 16);
+    pthread_create(&thread, NULL, spsc_producer, NULL);
+
+    for (uint32_t i = 0; i < iterations; ++i) {
+        while (spsc_pop(&spsc, &value) != 0) {
+            sched_yield();
+        }
+        if (value != i) {
+            fprintf(stderr, "spsc: got %u, expected %u\n", value, i);
+            failed = 1;
+            break;
+        }
+    }
+
+    pthread_join(thread, NULL);
+    fprintf(stderr, "spsc: %u values, queue full %u times\n", iterations, spsc_full);
+}
+
+
+/*
+ * Values are the producer in the top bits and a running count below,
+ * which the consumer expects in order per producer.
+ */
+static struct mpsc mpsc;
+static struct mpsc_slot mpsc_slots[16];
+
+
+static void* mpsc_producer(void* arg)
+{
+    uint32_t id = (uintptr_t) arg;
+
+    for (uint32_t i = 0; i < iterations; ++i) {
+        while (mpsc_push(&mpsc, (id << 28) | i) != 0) {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+
+static void test_mpsc(void)
+{
+    pthread_t threads[PRODUCERS];
+    uint32_t next[PRODUCERS] = { 0 };
+    uint32_t value;
+
+    mpsc_init(&mpsc, mpsc_slots, 16);
+    for (int i = 0; i < PRODUCERS; ++i) {
+        pthread_create(&threads[i], NULL, mpsc_producer, (void*) (uintptr_t) i);
+    }
+
+    for (uint32_t n = 0; n < PRODUCERS * iterations && !failed; ++n) {
+        while (mpsc_pop(&mpsc, &value) != 0) {
+            sched_yield();
+        }
+
+        uint32_t id = value >> 28;
+        if (id >= PRODUCERS || (value & 0x0fffffff) != next[id]) {
+            fprintf(stderr, "mpsc: got %x, expected %x\n", value, (id << 28) | next[id]);
+            failed = 1;
+        }
+        ++next[id % PRODUCERS];
+    }
+
+    for (int i = 0; i < PRODUCERS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (mpsc_pop(&mpsc, &value) == 0) {
+        fprintf(stderr, "mpsc: value left in queue\n");
+        failed = 1;
+    }
+
+    fprintf(stderr, "mpsc: %u values from %d producers\n", PRODUCERS * iterations, PRODUCERS);
+}
+
+
+/*
+ * The writer keeps all words equal, the reader must never see them
+ * differ. The reader yields while copying, the writer only between
+ * updates, as it stands in for an ISR.
+ */
+static struct seqlock lock;
+static volatile uint32_t words[8];
+static volatile int stop;
+
+
+static void* writer(void* arg)
+{
+    (void) arg;
+
+    for (uint32_t i = 0; !stop; ++i) {
+        seqlock_write_begin(&lock);
+        for (int j = 0; j < 8; ++j) {
+            words[j] = i;
+        }
+        seqlock_write_end(&lock);
+        sched_yield();
+    }
+
+    return NULL;
+}
+
+
+static void test_seqlock(void)
+{
+    pthread_t thread;
+    uint32_t retries = 0;
+
+    pthread_create(&thread, NULL, writer, NULL);
+
+    for (uint32_t i = 0; i < iterations; ++i) {
+        uint32_t copy[8];
+        uint32_t seq;
+
+        seq = seqlock_read_begin(&lock);
+        while (1) {
+            for (int j = 0; j < 8; ++j) {
+                copy[j] = words[j];
+                preempt();
+            }
+            if (!seqlock_read_retry(&lock, seq)) {
+                break;
+            }
+            ++retries;
+            seq = seqlock_read_begin(&lock);
+        }
+
+        for (int j = 1; j < 8; ++j) {
+            if (copy[j] != copy[0]) {
+                fprintf(stderr, "seqlock: torn read %u/%u\n", copy[0], copy[j]);
+                failed = 1;
+                break;
+            }
+        }
+    }
+
+    stop = 1;
+    pthread_join(thread, NULL);
+    fprintf(stderr, "seqlock: %u reads, %u retries\n", iterations, retries);
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) {
+        iterations = strtoul(argv[1], NULL, 0);
+    }
+
+    test_counter();
+    test_spsc();
+    test_mpsc();
+    test_seqlock();
+
+    if (failed) {
+        return 1;
+    }
+
+    fprintf(stderr, "atomictest: OK\n");
+    return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * Bootloader emulator.
+ *
+ * Runs the bootloader protocol (../boot.c) on the host, with flash
+ * emulated in RAM at its device address and USART1 replaced by a pty,
+ * so that it can be driven by upload. Flash behaves as on the device:
+ * pages erase to 0xff, and programming a half-word that is not erased
+ * fails.
+ *
+ * Prints the pty name on stdout. When the bootloader resets, the image
+ * (as described by the image information) is written to the output file
+ * and the exit status tells whether the bootloader would start it.
+ *
+ * Usage: bootemu [-d n] <image.out>
+ *
+ *   -d n  Drop every nth received byte
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../boot.h"
+#include "../flash.h"
+#include "../crc.h"
+
+#define FLASH_BASE  0x08000000
+#define FLASH_SIZE  (64 * 1024)
+
+
+static int fd;
+static const char* out_path;
+static unsigned writes;
+static unsigned erases;
+
+
+void flash_unlock(void)
+{
+}
+
+
+void flash_lock(void)
+{
+}
+
+
+int flash_erase(uint32_t addr)
+{
+    if (addr < BOOT_INFO_BASE || addr >= FLASH_BASE + FLASH_SIZE) {
+        return -EIO;
+    }
+
+    memset((void*) (uintptr_t) (addr & ~(FLASH_PAGE_SIZE - 1)), 0xff, FLASH_PAGE_SIZE);
+    ++erases;
+    return 0;
+}
+
+
+int flash_write(uint32_t addr, uint16_t value)
+{
+    volatile uint16_t* p = (volatile uint16_t*) (uintptr_t) addr;
+
+    if ((addr & 1) || addr < BOOT_INFO_BASE || addr >= FLASH_BASE + FLASH_SIZE) {
+        return -EIO;
+    }
+
+    // Only zero may be written over a programmed half-word
+    if (*p != 0xffff && value != 0) {
+        fprintf(stderr, "bootemu: write to %08x, which is not erased\n", addr);
+        return -EIO;
+    }
+
+    *p = value;
+    ++writes;
+    return 0;
+}
+
+
+uint32_t crc32(const void* buf, size_t len)
+{
+    const uint8_t* p = buf;
+    uint32_t crc = 0xffffffff;
+
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+
+    return ~crc;
+}
+
+
+void boot_putc(uint8_t byte)
+{
+    while (write(fd, &byte, 1) != 1) {
+        usleep(100);
+    }
+}
+
+
+void boot_reset(void)
+{
+    const struct boot_info* info = (const struct boot_info*) BOOT_INFO_BASE;
+    int valid = info->magic == BOOT_INFO_MAGIC && info->valid == 0 && info->length <= BOOT_APP_SIZE;
+    uint8_t byte;
+
+    // Closing the pty would discard the reply, so wait until the host
+    // has hung up
+    while (read(fd, &byte, 1) >= 0 || errno != EIO);
+
+    fprintf(stderr, "bootemu: reset after %u page erases and %u half-word writes\n",
+            erases, writes);
+
+    FILE* fp = fopen(out_path, "wb");
+    if (fp == NULL || (valid && fwrite((const void*) BOOT_APP_BASE, 1, info->length, fp) != info->length)) {
+        perror(out_path);
+        exit(2);
+    }
+    fclose(fp);
+
+    // The image need not be a firmware, so only the image information
+    // is checked rather than boot_app_valid()
+    if (!valid || crc32((const void*) BOOT_APP_BASE, info->length) != info->crc) {
+        fprintf(stderr, "bootemu: image is not valid\n");
+        exit(1);
+    }
+
+    exit(0);
+}
+
+
+int main(int argc, char** argv)
+{
+    unsigned drop = 0;
+    unsigned received = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+            case 'd':
+                drop = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d n] <image.out>\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (optind + 1 > argc) {
+        fprintf(stderr, "Usage: %s [-d n] <image.out>\n", argv[0]);
+        return 2;
+    }
+    out_path = argv[optind];
+
+    // boot.c addresses flash by its device addresses
+    void* flash = mmap((void*) FLASH_BASE, FLASH_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (flash != (void*) FLASH_BASE) {
+        perror("mmap");
+        return 2;
+    }
+    memset(flash, 0xff, FLASH_SIZE);
+
+    int slave;
+    char name[64];
+    struct termios tio;
+
+    if (openpty(&fd, &slave, name, NULL, NULL) != 0) {
+        perror("openpty");
+        return 2;
+    }
+
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    close(slave);
+
+    printf("%s\n", name);
+    fflush(stdout);
+
+    while (1) {
+        uint8_t buf[256];
+        ssize_t n = read(fd, buf, sizeof(buf));
+
+        // Until the host has opened the pty
+        if (n < 0 && errno == EIO) {
+            usleep(1000);
+            continue;
+        } else if (n < 0) {
+            perror("read");
+            return 2;
+        }
+
+        for (ssize_t i = 0; i < n; ++i) {
+            if (drop == 0 || ++received % drop != 0) {
+                boot_feed(buf[i]);
+            }
+        }
+    }
+}
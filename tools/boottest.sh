@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Upload test images to the bootloader emulator (see bootemu.c) and check
+# that the programmed images match.
+#
+# Usage: boottest.sh
+#
+set -e
+cd "$(dirname "$0")"
+
+img=boottest.img
+out=boottest.out
+pty=boottest.pty
+
+trap 'rm -f $img $out $pty' EXIT
+
+
+# run <bootemu options> -- <upload options>
+run()
+{
+    emu_opts=
+    while [ "$1" != "--" ]; do
+        emu_opts="$emu_opts $1"
+        shift
+    done
+    shift
+
+    rm -f $out $pty
+    ./bootemu $emu_opts $out > $pty &
+    emu=$!
+
+    while [ ! -s $pty ]; do
+        sleep 0.1
+    done
+
+    ./upload "$@" "$(cat $pty)" $img
+    wait $emu
+
+    cmp $img $out
+}
+
+
+# Sources compress about as well as code, the odd length leaves a byte
+# for the last half-word
+cat ../*.c | head -c 40001 > $img
+run -- 
+run -- -r
+run -d 3001 --
+
+# Too short for any match
+head -c 11 ../boot.c > $img
+run --
+
+echo "boottest: OK" >&2
@@ -0,0 +1,131 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include "frame.h"
+
+
+uint16_t crc16(uint16_t crc, const void* data, size_t len)
+{
+    const uint8_t* p = data;
+
+    while (len--) {
+        crc ^= *p++ << 8;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+
+size_t cobs_encode(const void* src, size_t len, uint8_t* dst)
+{
+    const uint8_t* p = src;
+    size_t code_pos = 0;
+    size_t n = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; ++i) {
+        if (p[i] != 0) {
+            dst[n++] = p[i];
+            ++code;
+        }
+
+        if (p[i] == 0 || code == 0xff) {
+            dst[code_pos] = code;
+            code_pos = n++;
+            code = 1;
+        }
+    }
+
+    dst[code_pos] = code;
+    return n;
+}
+
+
+long cobs_decode(const uint8_t* src, size_t len, uint8_t* dst)
+{
+    size_t i = 0;
+    size_t n = 0;
+
+    while (i < len) {
+        uint8_t code = src[i++];
+        if (code == 0 || i + code - 1 > len) {
+            return -1;
+        }
+
+        for (uint8_t j = 1; j < code; ++j) {
+            dst[n++] = src[i++];
+        }
+
+        // A zero is implied after every block except 0xff blocks
+        // and the last one
+        if (code != 0xff && i < len) {
+            dst[n++] = 0;
+        }
+    }
+
+    return n;
+}
+
+
+size_t frame_encode(uint16_t seq, uint8_t type, const void* data, size_t len, uint8_t* dst)
+{
+    static uint8_t buf[70000];
+    const uint8_t* p = data;
+
+    buf[0] = seq & 0xff;
+    buf[1] = seq >> 8;
+    buf[2] = type;
+    for (size_t i = 0; i < len; ++i) {
+        buf[3 + i] = p[i];
+    }
+
+    uint16_t crc = crc16(0xffff, buf, len + 3);
+    buf[len + 3] = crc & 0xff;
+    buf[len + 4] = crc >> 8;
+
+    size_t n = cobs_encode(buf, len + 5, dst);
+    dst[n++] = 0;
+    return n;
+}
+
+
+int framer_feed(struct framer* fr, uint8_t byte, struct frame* f)
+{
+    if (byte != 0) {
+        if (fr->n < sizeof(fr->raw)) {
+            fr->raw[fr->n++] = byte;
+        } else {
+            fr->overflow = 1;
+        }
+        return 0;
+    }
+
+    size_t n = fr->n;
+    int overflow = fr->overflow;
+    fr->n = 0;
+    fr->overflow = 0;
+
+    // Back-to-back delimiters
+    if (n == 0 && !overflow) {
+        return 0;
+    }
+
+    long len = overflow ? -1 : cobs_decode(fr->raw, n, fr->buf);
+    if (len < 5) {
+        return -EPROTO;
+    }
+
+    uint16_t crc = fr->buf[len - 2] | (fr->buf[len - 1] << 8);
+    if (crc16(0xffff, fr->buf, len - 2) != crc) {
+        return -EBADMSG;
+    }
+
+    f->seq = fr->buf[0] | (fr->buf[1] << 8);
+    f->type = fr->buf[2];
+    f->data = &fr->buf[3];
+    f->len = len - 5;
+    return 1;
+}
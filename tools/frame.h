@@ -0,0 +1,73 @@
+#ifndef __TOOLS_FRAME_H__
+#define __TOOLS_FRAME_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/*
+ * Host side of the telemetry framing (see telemetry.h):
+ *
+ *   COBS( seq (2, LE) | type (1) | payload | CRC-16 (2, LE) ) | 0x00
+ */
+struct frame
+{
+    uint16_t seq;
+    uint8_t type;
+    const uint8_t* data;
+    size_t len;
+};
+
+
+/*
+ * Frame receiver.
+ * Accumulates bytes from the link until a zero delimiter is seen.
+ */
+struct framer
+{
+    uint8_t raw[70000];     // Encoded bytes of current frame
+    uint8_t buf[70000];     // Decoded frame
+    size_t n;
+    int overflow;
+};
+
+
+/*
+ * CRC-16/CCITT-FALSE. Pass 0xffff as crc for a new checksum.
+ */
+uint16_t crc16(uint16_t crc, const void* data, size_t len);
+
+
+/*
+ * COBS encode len bytes from src into dst, which must hold at least
+ * len + len / 254 + 1 bytes. The delimiter is not appended.
+ * Returns the number of encoded bytes.
+ */
+size_t cobs_encode(const void* src, size_t len, uint8_t* dst);
+
+
+/*
+ * COBS decode len bytes (without delimiter) from src into dst, which must
+ * hold at least len bytes. Returns the number of decoded bytes, or -1
+ * if the input is malformed.
+ */
+long cobs_decode(const uint8_t* src, size_t len, uint8_t* dst);
+
+
+/*
+ * Encode a complete frame including delimiter into dst, which must hold
+ * at least len + len / 254 + 7 bytes. Returns the number of bytes.
+ */
+size_t frame_encode(uint16_t seq, uint8_t type, const void* data, size_t len, uint8_t* dst);
+
+
+/*
+ * Feed one byte from the link to the receiver.
+ *
+ * Returns 0 if no frame is complete yet, 1 if a valid frame was received
+ * (and stored in f), -EBADMSG on CRC mismatch and -EPROTO on a malformed
+ * frame (bad COBS, too short or too long).
+ */
+int framer_feed(struct framer* fr, uint8_t byte, struct frame* f);
+
+#endif
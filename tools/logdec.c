@@ -0,0 +1,275 @@
+/*
+ * Log decoder.
+ *
+ * Reads TELEMETRY_LOG frames (see log.h) from a serial port or capture
+ * file, and formats the messages using the format strings stored in the
+ * .logfmt section of the firmware ELF file.
+ *
+ * Usage: logdec [-b baud] <image.elf> <device|file>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <elf.h>
+#include <unistd.h>
+#include "frame.h"
+#include "serial.h"
+
+#define TELEMETRY_TEXT  0x01
+#define TELEMETRY_LOG   0x04
+#define LOG_ID_DROPPED  0xffff
+
+
+/*
+ * Firmware image
+ */
+static uint8_t* image;
+static size_t image_size;
+static const Elf32_Shdr* sections;
+static int num_sections;
+static const char* fmt_base;
+static size_t fmt_size;
+
+
+static int load_elf(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    image_size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    image = malloc(image_size);
+    if (image == NULL || fread(image, 1, image_size, fp) != image_size) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    const Elf32_Ehdr* ehdr = (const Elf32_Ehdr*) image;
+    if (image_size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0
+            || ehdr->e_ident[EI_CLASS] != ELFCLASS32
+            || ehdr->e_shoff + (size_t) ehdr->e_shnum * sizeof(Elf32_Shdr) > image_size) {
+        errno = ENOEXEC;
+        return -1;
+    }
+
+    sections = (const Elf32_Shdr*) (image + ehdr->e_shoff);
+    num_sections = ehdr->e_shnum;
+
+    const char* names = (const char*) image + sections[ehdr->e_shstrndx].sh_offset;
+    for (int i = 0; i < num_sections; ++i) {
+        if (strcmp(names + sections[i].sh_name, ".logfmt") == 0) {
+            fmt_base = (const char*) image + sections[i].sh_offset;
+            fmt_size = sections[i].sh_size;
+        }
+    }
+
+    if (fmt_base == NULL) {
+        fprintf(stderr, "%s: no .logfmt section\n", path);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Look up a string in the loaded sections of the image (for %s)
+ */
+static const char* lookup_string(uint32_t addr)
+{
+    for (int i = 0; i < num_sections; ++i) {
+        const Elf32_Shdr* sh = &sections[i];
+
+        if ((sh->sh_flags & SHF_ALLOC) && sh->sh_type == SHT_PROGBITS
+                && sh->sh_addr <= addr && addr < sh->sh_addr + sh->sh_size) {
+            const char* str = (const char*) image + sh->sh_offset + (addr - sh->sh_addr);
+            if (memchr(str, '\0', sh->sh_addr + sh->sh_size - addr) != NULL) {
+                return str;
+            }
+        }
+    }
+
+    return "(?)";
+}
+
+
+/*
+ * printf() the format string with 32-bit arguments
+ */
+static void format(const char* fmt, const uint32_t* args, unsigned nargs)
+{
+    unsigned arg = 0;
+    const char* p = fmt;
+
+    while (*p != '\0') {
+        if (*p != '%') {
+            putchar(*p++);
+            continue;
+        }
+
+        if (p[1] == '%') {
+            putchar('%');
+            p += 2;
+            continue;
+        }
+
+        // Copy flags, width and precision, drop length modifiers
+        char spec[32];
+        size_t n = 0;
+        spec[n++] = *p++;
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL && n < sizeof(spec) - 3) {
+            spec[n++] = *p++;
+        }
+        while (*p != '\0' && strchr("hlzjt", *p) != NULL) {
+            ++p;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        char conv = *p++;
+        spec[n++] = conv;
+        spec[n] = '\0';
+
+        uint32_t value = arg < nargs ? args[arg++] : 0;
+
+        switch (conv) {
+            case 'd':
+            case 'i':
+                printf(spec, (int) (int32_t) value);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                printf(spec, (unsigned) value);
+                break;
+            case 'c':
+                printf(spec, (int) value);
+                break;
+            case 'p':
+                printf("0x%08x", (unsigned) value);
+                break;
+            case 's':
+                printf(spec, lookup_string(value));
+                break;
+            default:
+                printf("%s", spec);
+                break;
+        }
+    }
+
+    if (p == fmt || p[-1] != '\n') {
+        putchar('\n');
+    }
+}
+
+
+static void decode(const uint8_t* data, size_t len)
+{
+    size_t nwords = len / 4;
+
+    for (size_t i = 0; i < nwords; ) {
+        const uint8_t* w = data + i * 4;
+        uint32_t header = w[0] | (w[1] << 8) | (w[2] << 16) | ((uint32_t) w[3] << 24);
+        unsigned n = header & 0xf;
+        unsigned id = header >> 16;
+        uint32_t args[15];
+
+        if (n == 0 || i + n > nwords) {
+            printf("*** corrupt log frame\n");
+            return;
+        }
+
+        for (unsigned j = 1; j < n; ++j) {
+            const uint8_t* a = data + (i + j) * 4;
+            args[j - 1] = a[0] | (a[1] << 8) | (a[2] << 16) | ((uint32_t) a[3] << 24);
+        }
+
+        if (id == LOG_ID_DROPPED) {
+            printf("*** %u messages dropped\n", n > 1 ? args[0] : 0);
+        } else if (fmt_base == NULL || id >= fmt_size
+                || memchr(fmt_base + id, '\0', fmt_size - id) == NULL) {
+            printf("*** unknown message id %u\n", id);
+        } else {
+            format(fmt_base + id, args, n - 1);
+        }
+
+        i += n;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    static struct framer fr;
+    unsigned baud = 115200;
+    int have_seq = 0;
+    uint16_t next_seq = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        switch (opt) {
+            case 'b':
+                baud = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-b baud] <image.elf> <device|file>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind + 2 > argc) {
+        fprintf(stderr, "Usage: %s [-b baud] <image.elf> <device|file>\n", argv[0]);
+        return 1;
+    }
+
+    if (load_elf(argv[optind]) < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    int fd = serial_open(argv[optind + 1], baud);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind + 1], strerror(errno));
+        return 1;
+    }
+
+    uint8_t buf[4096];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; ++i) {
+            struct frame f;
+            int err = framer_feed(&fr, buf[i], &f);
+
+            if (err < 0) {
+                printf("*** %s\n", err == -EBADMSG ? "CRC error" : "malformed frame");
+                continue;
+            } else if (err == 0) {
+                continue;
+            }
+
+            if (have_seq && f.seq != next_seq) {
+                printf("*** %u frames lost\n", (uint16_t) (f.seq - next_seq));
+            }
+            have_seq = 1;
+            next_seq = f.seq + 1;
+
+            if (f.type == TELEMETRY_LOG) {
+                decode(f.data, f.len);
+            } else if (f.type == TELEMETRY_TEXT) {
+                printf("%.*s", (int) f.len, (const char*) f.data);
+            }
+        }
+        fflush(stdout);
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include "serial.h"
+
+
+int serial_open(const char* path, unsigned baud)
+{
+    struct termios2 tio;
+
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // Not a terminal, probably a capture file
+    if (ioctl(fd, TCGETS2, &tio) < 0) {
+        return fd;
+    }
+
+    tio.c_iflag = 0;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cflag = BOTHER | CS8 | CLOCAL | CREAD;
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+
+    if (ioctl(fd, TCSETS2, &tio) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
@@ -0,0 +1,16 @@
+#ifndef __TOOLS_SERIAL_H__
+#define __TOOLS_SERIAL_H__
+
+
+/*
+ * Open a serial port (or a regular file) for reading and writing.
+ *
+ * If path refers to a terminal, it is set to raw 8N1 mode with the given
+ * baud rate. Arbitrary baud rates (such as 4500000) are supported by
+ * using the Linux termios2 interface.
+ *
+ * Returns a file descriptor on success, and -1 on failure (errno is set).
+ */
+int serial_open(const char* path, unsigned baud);
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Telemetry decoder.
+ *
+ * Reads COBS framed telemetry (see telemetry.h) from a serial port or
+ * capture file and reports throughput, lost frames (sequence number
+ * gaps) and CRC errors once per second.
+ *
+ * Usage: teledec [-b baud] [-v] <device|file>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "frame.h"
+#include "serial.h"
+
+
+struct stats
+{
+    unsigned long bytes;    // Bytes read from link
+    unsigned long payload;  // Payload bytes in valid frames
+    unsigned long frames;   // Valid frames
+    unsigned long lost;     // Frames missing according to sequence numbers
+    unsigned long crc;      // CRC errors
+    unsigned long proto;    // Malformed frames
+};
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void report(const char* what, const struct stats* s, double secs)
+{
+    fprintf(stderr, "%s: %.1f kB/s link, %.1f kB/s payload, %.0f frames/s, "
+            "%lu frames, %lu lost, %lu crc errors, %lu malformed\n",
+            what, s->bytes / secs / 1e3, s->payload / secs / 1e3, s->frames / secs,
+            s->frames, s->lost, s->crc, s->proto);
+}
+
+
+static void dump(const struct frame* f)
+{
+    printf("seq=%u type=%u len=%zu", f->seq, f->type, f->len);
+
+    switch (f->type) {
+        case 0x01: // TELEMETRY_TEXT
+            printf(" \"%.*s\"", (int) f->len, (const char*) f->data);
+            break;
+
+        case 0x02: // TELEMETRY_COUNTERS
+            for (size_t i = 0; i + 4 <= f->len; i += 4) {
+                uint32_t v = f->data[i] | (f->data[i + 1] << 8)
+                    | (f->data[i + 2] << 16) | ((uint32_t) f->data[i + 3] << 24);
+                printf(" %u", v);
+            }
+            break;
+
+        case 0x03: // TELEMETRY_SAMPLES
+            {
+                unsigned min = 0xffff, max = 0;
+                for (size_t i = 0; i + 2 <= f->len; i += 2) {
+                    unsigned v = f->data[i] | (f->data[i + 1] << 8);
+                    min = v < min ? v : min;
+                    max = v > max ? v : max;
+                }
+                if (f->len >= 2) {
+                    printf(" samples=%zu min=%u max=%u", f->len / 2, min, max);
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    printf("\n");
+}
+
+
+int main(int argc, char** argv)
+{
+    static struct framer fr;
+    struct stats total = {0}, interval = {0};
+    unsigned baud = 115200;
+    int verbose = 0;
+    int have_seq = 0;
+    uint16_t next_seq = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:v")) != -1) {
+        switch (opt) {
+            case 'b':
+                baud = strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-b baud] [-v] <device|file>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-b baud] [-v] <device|file>\n", argv[0]);
+        return 1;
+    }
+
+    int fd = serial_open(argv[optind], baud);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    double start = now();
+    double last = start;
+    uint8_t buf[4096];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        interval.bytes += n;
+
+        for (ssize_t i = 0; i < n; ++i) {
+            struct frame f;
+            int err = framer_feed(&fr, buf[i], &f);
+
+            if (err == -EBADMSG) {
+                ++interval.crc;
+            } else if (err < 0) {
+                ++interval.proto;
+            } else if (err > 0) {
+                if (have_seq) {
+                    interval.lost += (uint16_t) (f.seq - next_seq);
+                }
+                have_seq = 1;
+                next_seq = f.seq + 1;
+
+                ++interval.frames;
+                interval.payload += f.len;
+
+                if (verbose) {
+                    dump(&f);
+                }
+            }
+        }
+
+        double t = now();
+        if (t - last >= 1.0) {
+            report("rate", &interval, t - last);
+            total.bytes += interval.bytes;
+            total.payload += interval.payload;
+            total.frames += interval.frames;
+            total.lost += interval.lost;
+            total.crc += interval.crc;
+            total.proto += interval.proto;
+            memset(&interval, 0, sizeof(interval));
+            last = t;
+        }
+    }
+
+    total.bytes += interval.bytes;
+    total.payload += interval.payload;
+    total.frames += interval.frames;
+    total.lost += interval.lost;
+    total.crc += interval.crc;
+    total.proto += interval.proto;
+
+    double t = now() - start;
+    report("total", &total, t > 0 ? t : 1);
+
+    close(fd);
+    return 0;
+}
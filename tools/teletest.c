@@ -0,0 +1,260 @@
+/*
+ * Telemetry encoder round-trip test.
+ *
+ * Builds the firmware encoder (../telemetry.c) on the host, with the DMA
+ * transfers appending to a buffer and the completion interrupt called
+ * directly, and checks the output against frame_encode() and the
+ * receiver in frame.c.
+ *
+ * Usage: teletest
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Interrupt control, which is ARM only, is replaced below
+#define __STM32F103C8_INTERRUPTS_H__
+#define IRQ_DMA1_Channel4   14
+#define IRQ_USART1          37
+
+static uint32_t irq_save(void) { return 0; }
+static void irq_restore(uint32_t primask) { (void) primask; }
+static int irq_enable(int irq) { (void) irq; return 0; }
+static int irq_attach(int irq, void (*handler)(void* arg), void* arg)
+{
+    (void) irq; (void) handler; (void) arg;
+    return 0;
+}
+
+#include "../telemetry.c"
+#include "frame.h"
+
+
+volatile struct dma dma1;
+volatile struct usart usart1;
+volatile struct gpio gpioa;
+volatile struct rcc rcc;
+
+
+/*
+ * Link output and DMA state
+ */
+static uint8_t out[1 << 20];
+static size_t out_len;
+static int busy;
+static int refs;
+static int failed;
+
+
+int dma_start(volatile struct dma* dma, int channel, volatile void* periph,
+              const volatile void* mem, uint16_t count, uint32_t flags)
+{
+    (void) dma; (void) channel; (void) periph; (void) flags;
+
+    if (busy) {
+        fprintf(stderr, "DMA restarted before the transfer completed\n");
+        failed = 1;
+    }
+
+    // Otherwise transmission complete may be taken before the frame is out
+    if (usart1.sr & (1 << 6)) {
+        fprintf(stderr, "DMA started with TC set\n");
+        failed = 1;
+    }
+
+    memcpy(out + out_len, (const void*) mem, count);
+    out_len += count;
+    busy = 1;
+    return 0;
+}
+
+
+uint16_t dma_stop(volatile struct dma* dma, int channel)
+{
+    (void) dma; (void) channel;
+    busy = 0;
+    return 0;
+}
+
+
+void clk_get(enum clk clk) { (void) clk; ++refs; }
+void clk_put(enum clk clk) { (void) clk; --refs; }
+int gpio_cfg(volatile struct gpio* port, int pin, enum gpio_cnf cnf, enum gpio_mode mode)
+{
+    (void) port; (void) pin; (void) cnf; (void) mode;
+    return 0;
+}
+int rcc_pclk2(void) { return 72000000; }
+
+
+/*
+ * Run DMA completions until the link is idle, then the USART
+ * transmission complete interrupt. The completions are served late,
+ * after the USART has gone idle and set TC.
+ */
+static void drain(void)
+{
+    while (busy) {
+        busy = 0;
+        usart1.sr |= 1 << 6;
+        dma_handler(NULL);
+    }
+    usart_handler(NULL);
+}
+
+
+static uint8_t payloads[8][1024];
+static struct telemetry_frame frames[8];
+static struct telemetry_frame chained;
+
+
+/*
+ * Queue another frame from the completion callback, when the link has
+ * just gone idle.
+ */
+static void chain(struct telemetry_frame* frame, void* arg)
+{
+    (void) frame;
+    (void) arg;
+    telemetry_send(&chained);
+}
+
+
+/*
+ * Send frames and check that the output is what frame_encode() produces,
+ * and that it decodes back to the same frames.
+ */
+static void check(const char* name, struct telemetry_frame** fs, int n)
+{
+    static uint8_t expected[1 << 20];
+    static struct framer fr;
+    size_t expected_len = 0;
+    uint16_t first = tx.seq;
+
+    out_len = 0;
+    for (int i = 0; i < n; ++i) {
+        telemetry_send(fs[i]);
+    }
+    drain();
+
+    int count = n + (fs[n - 1]->callback == chain);
+    for (int i = 0; i < count; ++i) {
+        struct telemetry_frame* f = i < n ? fs[i] : &chained;
+        expected_len += frame_encode(first + i, f->type, f->data, f->len, expected + expected_len);
+    }
+
+    if (out_len != expected_len || memcmp(out, expected, out_len) != 0) {
+        fprintf(stderr, "%s: output differs from frame_encode()\n", name);
+        failed = 1;
+    }
+
+    int received = 0;
+    for (size_t i = 0; i < out_len; ++i) {
+        struct frame f;
+        int ret = framer_feed(&fr, out[i], &f);
+
+        if (ret < 0) {
+            fprintf(stderr, "%s: framer_feed() returned %d\n", name, ret);
+            failed = 1;
+        } else if (ret == 1) {
+            struct telemetry_frame* sent = received < n ? fs[received] : &chained;
+
+            if (received >= count || f.seq != (uint16_t) (first + received)
+                    || f.type != sent->type || f.len != sent->len
+                    || memcmp(f.data, sent->data, f.len) != 0) {
+                fprintf(stderr, "%s: frame %d does not match\n", name, received);
+                failed = 1;
+            }
+            ++received;
+        }
+    }
+
+    if (received != count) {
+        fprintf(stderr, "%s: received %d of %d frames\n", name, received, count);
+        failed = 1;
+    }
+
+    if (refs != 0) {
+        fprintf(stderr, "%s: %d clock references left\n", name, refs);
+        failed = 1;
+    }
+}
+
+
+static void single(const char* name, const uint8_t* data, uint16_t len)
+{
+    struct telemetry_frame* f = &frames[0];
+
+    *f = (struct telemetry_frame) { .type = TELEMETRY_SAMPLES, .data = data, .len = len };
+    check(name, &f, 1);
+}
+
+
+int main(void)
+{
+    uint8_t* p = payloads[0];
+
+    telemetry_init(115200);
+
+    single("empty", NULL, 0);
+
+    memset(p, 0, 1024);
+    single("all zeros", p, 1);
+    single("all zeros", p, 300);
+
+    for (int i = 0; i < 1024; ++i) {
+        p[i] = i % 255 + 1;
+    }
+    single("no zeros", p, 1);
+    single("no zeros", p, 300);
+    single("no zeros", p, 1024);
+
+    // Runs of 254 non-zero bytes fill a COBS block exactly
+    single("253 bytes", p, 253);
+    single("254 bytes", p, 254);
+    single("255 bytes", p, 255);
+
+    p[0] = 0;
+    p[254] = 0;
+    single("254 bytes between zeros", p, 256);
+    p[0] = 1;
+    p[254] = 1;
+
+    // Without zeros in the sequence number, the header is part of the
+    // first run
+    tx.seq = 0x0101;
+    single("254 bytes with header", p, 251);
+
+    // Back to back, and queued from a completion callback on an idle link
+    struct telemetry_frame* fs[8];
+    srand(1);
+    for (int round = 0; round < 1000; ++round) {
+        int n = rand() % 8 + 1;
+
+        for (int i = 0; i < n; ++i) {
+            int len = rand() % 1024;
+            int zeros = rand() % 4;
+
+            for (int j = 0; j < len; ++j) {
+                payloads[i][j] = zeros && rand() % (1 << zeros * 2) == 0 ? 0 : rand();
+            }
+            frames[i] = (struct telemetry_frame) { .type = rand(), .data = payloads[i], .len = len };
+            fs[i] = &frames[i];
+        }
+
+        chained = (struct telemetry_frame) { .type = TELEMETRY_TEXT, .data = "chained", .len = 7 };
+        if (round & 1) {
+            frames[n - 1].callback = chain;
+        }
+
+        check("random", fs, n);
+    }
+
+    if (failed) {
+        return 1;
+    }
+
+    fprintf(stderr, "teletest: OK\n");
+    return 0;
+}
@@ -0,0 +1,399 @@
+/*
+ * Firmware uploader for the UART bootloader (see boot.h).
+ *
+ * Compresses the image (LZ4 block format) and sends it to the bootloader,
+ * keeping up to BOOT_WINDOW data frames in flight so that the device can
+ * program flash while the next frames arrive. The bootloader must be
+ * running, either requested by the application or by holding the reset
+ * button (PB0) during reset.
+ *
+ * Usage: upload [-b baud] [-r] [-n] <device> <image.bin>
+ *
+ *   -r  Send the image uncompressed
+ *   -n  Do not start the application afterwards
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include "frame.h"
+#include "serial.h"
+
+#define BOOT_BAUD       1000000
+#define BOOT_HELLO      0x10
+#define BOOT_BEGIN      0x11
+#define BOOT_DATA       0x12
+#define BOOT_END        0x13
+#define BOOT_RUN        0x14
+#define BOOT_REPLY      0x20
+#define BOOT_DATA_MAX   256
+#define BOOT_WINDOW     4
+#define BOOT_RAW        0
+#define BOOT_LZ         1
+
+// Status codes are newlib errno values
+#define DEV_EAGAIN      11
+
+
+struct reply
+{
+    uint8_t type;
+    int8_t status;
+    uint16_t seq;
+    uint32_t value;
+};
+
+
+static int fd;
+static uint16_t seq;
+static struct framer fr;
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * CRC-32 as computed by zlib (and crc32() in crc.h)
+ */
+static uint32_t crc32(const uint8_t* data, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+
+    return ~crc;
+}
+
+
+static size_t put_length(uint8_t* dst, size_t len)
+{
+    size_t n = 0;
+
+    while (len >= 255) {
+        dst[n++] = 255;
+        len -= 255;
+    }
+    dst[n++] = len;
+    return n;
+}
+
+
+/*
+ * Compress into LZ4 block format with greedy hash matching.
+ * dst must hold at least len + len / 255 + 16 bytes.
+ *
+ * As LZ4 requires, no match starts in the last 12 bytes and the last 5
+ * bytes are literals.
+ */
+static size_t compress(const uint8_t* src, size_t len, uint8_t* dst)
+{
+    static int32_t table[1 << 14];
+    size_t anchor = 0;
+    size_t i = 0;
+    size_t n = 0;
+
+    memset(table, 0xff, sizeof(table));
+
+    while (i + 12 <= len) {
+        uint32_t v;
+        memcpy(&v, src + i, 4);
+
+        uint32_t h = (v * 2654435761u) >> 18;
+        int32_t cand = table[h];
+        table[h] = i;
+
+        if (cand < 0 || i - cand > 0xffff || memcmp(src + cand, src + i, 4) != 0) {
+            ++i;
+            continue;
+        }
+
+        size_t match = 4;
+        while (i + match < len - 5 && src[cand + match] == src[i + match]) {
+            ++match;
+        }
+
+        size_t lit = i - anchor;
+        size_t offset = i - cand;
+
+        dst[n++] = ((lit < 15 ? lit : 15) << 4) | (match - 4 < 15 ? match - 4 : 15);
+        if (lit >= 15) {
+            n += put_length(dst + n, lit - 15);
+        }
+        memcpy(dst + n, src + anchor, lit);
+        n += lit;
+
+        dst[n++] = offset & 0xff;
+        dst[n++] = offset >> 8;
+        if (match - 4 >= 15) {
+            n += put_length(dst + n, match - 4 - 15);
+        }
+
+        i += match;
+        anchor = i;
+    }
+
+    // Last sequence has literals only
+    if (anchor < len) {
+        size_t lit = len - anchor;
+
+        dst[n++] = (lit < 15 ? lit : 15) << 4;
+        if (lit >= 15) {
+            n += put_length(dst + n, lit - 15);
+        }
+        memcpy(dst + n, src + anchor, lit);
+        n += lit;
+    }
+
+    return n;
+}
+
+
+static uint16_t send(uint8_t type, const void* data, size_t len)
+{
+    uint8_t buf[BOOT_DATA_MAX + BOOT_DATA_MAX / 254 + 16];
+    size_t n = frame_encode(seq, type, data, len, buf);
+
+    if (write(fd, buf, n) != (ssize_t) n) {
+        perror("write");
+        exit(1);
+    }
+
+    return seq++;
+}
+
+
+/*
+ * Wait for a reply. Returns 0 on timeout.
+ */
+static int receive(struct reply* r, int timeout_ms)
+{
+    static uint8_t buf[256];
+    static ssize_t pos;
+    static ssize_t len;
+    double deadline = now() + timeout_ms / 1000.0;
+
+    while (1) {
+        // Bytes left over from the last read may hold further replies
+        while (pos < len) {
+            struct frame f;
+            if (framer_feed(&fr, buf[pos++], &f) == 1 && f.type == BOOT_REPLY && f.len == 8) {
+                r->type = f.data[0];
+                r->status = f.data[1];
+                r->seq = f.data[2] | (f.data[3] << 8);
+                r->value = f.data[4] | (f.data[5] << 8) | (f.data[6] << 16) | ((uint32_t) f.data[7] << 24);
+                return 1;
+            }
+        }
+
+        int left = (deadline - now()) * 1000;
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+        if (left <= 0 || poll(&pfd, 1, left) <= 0) {
+            return 0;
+        }
+
+        pos = 0;
+        len = read(fd, buf, sizeof(buf));
+        if (len <= 0) {
+            len = 0;
+            return 0;
+        }
+    }
+}
+
+
+/*
+ * Send a request and wait for its reply, retrying on timeout.
+ */
+static int request(uint8_t type, const void* data, size_t len, int timeout_ms, struct reply* r)
+{
+    for (int attempt = 0; attempt < 5; ++attempt) {
+        uint16_t s = send(type, data, len);
+
+        while (receive(r, timeout_ms)) {
+            if (r->type == type && r->seq == s) {
+                return r->status;
+            }
+        }
+    }
+
+    fprintf(stderr, "No reply from bootloader\n");
+    exit(1);
+}
+
+
+static int upload(const uint8_t* data, size_t len, uint16_t first)
+{
+    size_t blocks = (len + BOOT_DATA_MAX - 1) / BOOT_DATA_MAX;
+    size_t base = 0;        // Oldest block not acknowledged
+    size_t next = 0;        // Next block to send
+    size_t rewound = (size_t) -1;
+    int timeouts = 0;
+    struct reply r;
+
+    while (base < blocks) {
+        while (next < blocks && next < base + BOOT_WINDOW) {
+            size_t off = next * BOOT_DATA_MAX;
+            size_t n = len - off < BOOT_DATA_MAX ? len - off : BOOT_DATA_MAX;
+
+            seq = first + next;
+            send(BOOT_DATA, data + off, n);
+            ++next;
+        }
+
+        if (!receive(&r, 1000)) {
+            if (++timeouts > 10) {
+                fprintf(stderr, "Timed out\n");
+                return -1;
+            }
+            next = base;
+            continue;
+        }
+
+        if (r.type != BOOT_DATA) {
+            continue;
+        }
+
+        timeouts = 0;
+        size_t idx = (uint16_t) (r.seq - first);
+
+        if (r.status == 0) {
+            if (idx >= base && idx < next) {
+                base = idx + 1;
+            }
+        } else if (r.status == -DEV_EAGAIN) {
+            // Everything before the expected block has been received,
+            // go back to it once
+            idx = (uint16_t) (r.value - first);
+            if (idx > base && idx <= next) {
+                base = idx;
+            }
+            if (idx == base && idx != rewound) {
+                next = base;
+                rewound = base;
+            }
+        } else {
+            fprintf(stderr, "Block %zu failed: status %d\n", idx, r.status);
+            return -1;
+        }
+
+        fprintf(stderr, "\r%zu/%zu", base, blocks);
+    }
+
+    fprintf(stderr, "\n");
+    seq = first + blocks;
+    return 0;
+}
+
+
+int main(int argc, char** argv)
+{
+    unsigned baud = BOOT_BAUD;
+    int encoding = BOOT_LZ;
+    int run = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:rn")) != -1) {
+        switch (opt) {
+            case 'b':
+                baud = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                encoding = BOOT_RAW;
+                break;
+            case 'n':
+                run = 0;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-b baud] [-r] [-n] <device> <image.bin>\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind + 2 > argc) {
+        fprintf(stderr, "Usage: %s [-b baud] [-r] [-n] <device> <image.bin>\n", argv[0]);
+        return 1;
+    }
+
+    FILE* fp = fopen(argv[optind + 1], "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[optind + 1], strerror(errno));
+        return 1;
+    }
+
+    static uint8_t image[1 << 20];
+    size_t len = fread(image, 1, sizeof(image), fp);
+    fclose(fp);
+
+    static uint8_t encoded[(1 << 20) + (1 << 20) / 255 + 16];
+    size_t enc_len = len;
+    if (encoding == BOOT_LZ) {
+        enc_len = compress(image, len, encoded);
+    } else {
+        memcpy(encoded, image, len);
+    }
+
+    fd = serial_open(argv[optind], baud);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    struct reply r;
+    request(BOOT_HELLO, NULL, 0, 200, &r);
+    if (len == 0 || len > r.value) {
+        fprintf(stderr, "Image is %zu bytes, bootloader takes at most %u\n", len, r.value);
+        return 1;
+    }
+
+    uint32_t crc = crc32(image, len);
+    fprintf(stderr, "Image %zu bytes, CRC-32 %08x, sending %zu bytes (%.0f%%)\n",
+            len, crc, enc_len, 100.0 * enc_len / len);
+
+    uint8_t begin[9] = {
+        len & 0xff, (len >> 8) & 0xff, (len >> 16) & 0xff, len >> 24,
+        crc & 0xff, (crc >> 8) & 0xff, (crc >> 16) & 0xff, crc >> 24,
+        encoding
+    };
+
+    double start = now();
+
+    // Erasing takes a while
+    if (request(BOOT_BEGIN, begin, sizeof(begin), 5000, &r) != 0) {
+        fprintf(stderr, "Begin failed: status %d\n", r.status);
+        return 1;
+    }
+
+    if (upload(encoded, enc_len, r.seq + 1) != 0) {
+        return 1;
+    }
+
+    if (request(BOOT_END, NULL, 0, 1000, &r) != 0) {
+        fprintf(stderr, "Verification failed: status %d\n", r.status);
+        return 1;
+    }
+
+    double secs = now() - start;
+    fprintf(stderr, "Done in %.2f s (%.1f kB/s image)\n", secs, len / secs / 1e3);
+
+    if (run) {
+        request(BOOT_RUN, NULL, 0, 200, &r);
+    }
+
+    close(fd);
+    return 0;
+}